@@ -0,0 +1,67 @@
+// DotProductBenchmark.cpp : Compares Matrix::dotProduct against the old naive kernel.
+//
+// Linux:   g++ -std=c++17 -O3 -march=native -I ../CustomLibrary DotProductBenchmark.cpp -o DotProductBenchmark
+// Windows: cl /std:c++17 /O2 /arch:AVX2 /EHsc /I ..\CustomLibrary DotProductBenchmark.cpp
+//
+
+#include <iostream>
+#include <chrono>
+
+#include <CustomLibrary/Matrix.h>
+
+//The kernel Matrix::dotProduct used before blocking
+template<typename Type>
+auto naiveDotProduct(const ctl::Matrix<Type> &mat1, const ctl::Matrix<Type> &mat2)
+{
+	ctl::Matrix<Type> mat({ mat2.dim()[0], mat1.dim()[1] }, 0);
+
+	for (size_t y1 = 0; y1 < mat1.dim()[1]; ++y1)
+		for (size_t x2 = 0; x2 < mat2.dim()[0]; ++x2)
+			for (size_t x1 = 0; x1 < mat1.dim()[0]; ++x1)
+				mat(x2, y1) += mat1(x1, y1) * mat2(x2, x1);
+
+	return mat;
+}
+
+template<typename F>
+double seconds(F &&func, const size_t &repeat)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < repeat; ++i)
+		func();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeat;
+}
+
+template<typename Type>
+void run(const char *name, const size_t &size, ctl::RandomGen<ctl::Gen::Mersenne> &rand)
+{
+	auto a = ctl::Matrix<Type>({ size, size }, 0).randomize(rand, { -1, 1 });
+	auto b = ctl::Matrix<Type>({ size, size }, 0).randomize(rand, { -1, 1 });
+
+	const auto repeat = std::max<size_t>(1, (size_t(1) << 28) / (size * size * size));
+	ctl::Matrix<Type> naive, blocked = a.dotProduct(b);
+
+	const auto tNaive = seconds([&] { naive = naiveDotProduct(a, b); }, repeat);
+	const auto tBlocked = seconds([&] { blocked = a.dotProduct(b); }, repeat);
+
+	const auto flop = 2. * size * size * size;
+	std::cout << name << '\t' << size << '\t'
+		<< flop / tNaive * 1e-9 << "\tGFLOP/s\t"
+		<< flop / tBlocked * 1e-9 << "\tGFLOP/s\t"
+		<< tNaive / tBlocked << "x\t"
+		<< (naive.data() == blocked.data() ? "identical" : "DIFFERS") << '\n';
+}
+
+int main()
+{
+	ctl::RandomGen<ctl::Gen::Mersenne> rand;
+
+	std::cout << "type\tsize\tnaive\t\tblocked\t\tspeedup\tresult\n";
+	for (size_t size : { 64, 128, 256, 512, 1024 })
+	{
+		run<double>("double", size, rand);
+		run<float>("float", size, rand);
+	}
+
+	return 0;
+}
\ No newline at end of file
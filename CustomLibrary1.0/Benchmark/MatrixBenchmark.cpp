@@ -0,0 +1,378 @@
+// MatrixBenchmark.cpp : Times the core Matrix operations over sizes from 4 to 4096 and reports
+// GFLOP/s and GB/s, as a table and optionally as JSON to compare against a saved run.
+//
+// Linux:   g++ -std=c++17 -O3 -pthread -I ../CustomLibrary MatrixBenchmark.cpp -o MatrixBenchmark
+// Windows: cl /std:c++17 /O2 /EHsc /I ..\CustomLibrary MatrixBenchmark.cpp, or the Benchmark project
+//
+// MatrixBenchmark [--json FILE] [--baseline FILE] [--tolerance FRACTION] [--max-size N] [--min-time SECONDS] [--filter NAME] [--allocations]
+//
+//   --json       writes the results as JSON, - for stdout
+//   --baseline   compares against a JSON file written before, exits with 1 when a case got slower
+//                than the tolerance allows (default 0.1, 10%), or when the baseline is malformed or
+//                shares no case with this run. Warns when it ran on another instruction set or thread count
+//   --max-size   largest size run, 4096 by default
+//   --min-time   seconds each measurement runs for at least, 0.2 by default
+//   --filter     only runs cases whose name contains NAME
+//   --allocations  only counts heap allocations of steady state gemm, axpy, scal and hadamard on the whole
+//                pool, exits with 1 when there are any. Needs more than one hardware thread to check the threaded path
+//
+// Each case is measured three times and the fastest is kept, which is the steadiest figure to track.
+// FLOPs and bytes are the minimum the operation needs: a dotProduct counts 2n^3 FLOPs and reads
+// both operands and writes the result once.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <algorithm>
+
+#include <CustomLibrary/Matrix.h>
+#include <CustomLibrary/Blas.h>
+#include <CustomLibrary/Simd.h>
+
+//Heap allocations so far, every operator new is replaced to count them
+std::atomic<size_t> g_allocations{ 0 };
+
+void* countedMalloc(const std::size_t &size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return countedMalloc(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+//The block malloc returned is kept just before the aligned pointer
+void* operator new(std::size_t size, std::align_val_t align)
+{
+	const auto alignment = std::max(static_cast<std::size_t>(align), sizeof(void*));
+	auto *block = static_cast<char*>(countedMalloc(size + alignment));
+	auto *p = block + alignment - reinterpret_cast<std::uintptr_t>(block) % alignment;
+	reinterpret_cast<void**>(p)[-1] = block;
+	return p;
+}
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	if (p)
+		std::free(reinterpret_cast<void**>(p)[-1]);
+}
+void operator delete(void *p, std::size_t, std::align_val_t align) noexcept { ::operator delete(p, align); }
+
+struct Result
+{
+	std::string name;
+	std::string type;
+	size_t size;
+	double seconds;
+	double flop;
+	double bytes;
+
+	double gflops() const { return flop / seconds * 1e-9; }
+	double gbs() const { return bytes / seconds * 1e-9; }
+};
+
+struct Options
+{
+	std::string json;
+	std::string baseline;
+	double tolerance = 0.1;
+	size_t maxSize = 4096;
+	double minTime = 0.2;
+	std::string filter;
+	bool allocations = false;
+};
+
+//Sink so results can't be optimized away
+volatile double g_sink = 0;
+
+//Seconds per call of the fastest of three runs, each repeating func for at least minTime
+template<typename F>
+double measure(F &&func, const double &minTime)
+{
+	using Clock = std::chrono::steady_clock;
+
+	func();
+
+	size_t repeat = 1;
+	for (;;)
+	{
+		const auto start = Clock::now();
+		for (size_t i = 0; i < repeat; ++i)
+			func();
+		const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (elapsed >= minTime / 3)
+			break;
+		repeat = elapsed > 0 ? std::max(repeat + 1, size_t(repeat * minTime / 3 / elapsed * 1.2)) : repeat * 10;
+	}
+
+	double best = 0;
+	for (size_t run = 0; run < 3; ++run)
+	{
+		const auto start = Clock::now();
+		for (size_t i = 0; i < repeat; ++i)
+			func();
+		const auto seconds = std::chrono::duration<double>(Clock::now() - start).count() / repeat;
+
+		best = run == 0 ? seconds : std::min(best, seconds);
+	}
+
+	return best;
+}
+
+template<typename Type>
+void runType(const char *type, const Options &options, std::vector<Result> &results)
+{
+	ctl::RandomGen<ctl::Gen::Mersenne> rand;
+
+	for (size_t n = 4; n <= options.maxSize; n *= 4)
+	{
+		const double elements = double(n) * n, bytes = elements * sizeof(Type);
+
+		auto a = ctl::Matrix<Type>({ n, n }, 0).randomize(rand, { -1, 1 });
+		auto b = ctl::Matrix<Type>({ n, n }, 0).randomize(rand, { -1, 1 });
+		ctl::Matrix<Type> c({ n, n }, 0);
+
+		auto run = [&](const char *name, const double &flop, const double &traffic, auto &&func)
+		{
+			if (std::string(name).find(options.filter) == std::string::npos)
+				return;
+
+			results.push_back({ name, type, n, measure(func, options.minTime), flop, traffic });
+			g_sink = g_sink + double(c.loc(0));
+
+			const auto &r = results.back();
+			std::cout << std::left << std::setw(12) << r.name << std::setw(8) << r.type << std::right << std::setw(6) << r.size
+				<< std::fixed << std::setprecision(3) << std::setw(14) << r.seconds * 1e6 << " us"
+				<< std::setw(10) << r.gflops() << " GFLOP/s" << std::setw(10) << r.gbs() << " GB/s\n";
+		};
+
+		run("construct", 0, bytes, [&] { ctl::Matrix<Type> m({ n, n }, 0); g_sink = g_sink + double(m.loc(0)); });
+		run("scalar", elements, 2 * bytes, [&] { c = a * Type(2); });
+		run("elementwise", elements, 3 * bytes, [&] { c = a + b; });
+		run("dotProduct", 2 * elements * n, 3 * bytes, [&] { c = a.dotProduct(b); });
+		run("transpose", 0, 2 * bytes, [&] { c = a.transpose(); });
+		run("randomize", 0, bytes, [&] { c.randomize(rand, { -1, 1 }); });
+		run("apply", 2 * elements, 2 * bytes, [&] { c.apply([](Type &x) { x = x * Type(0.5) + Type(0.25); }); });
+	}
+}
+
+//Heap allocations over 100 steady state iterations of the Blas operations on the whole pool
+template<typename Type>
+size_t countAllocations(const char *type)
+{
+	ctl::RandomGen<ctl::Gen::Mersenne> rand;
+	const ctl::Parallel par{ 0, 0 };
+	const size_t n = 256;
+
+	auto a = ctl::Matrix<Type>({ n, n }, 0).randomize(rand, { -1, 1 });
+	auto b = ctl::Matrix<Type>({ n, n }, 0).randomize(rand, { -1, 1 });
+	ctl::Matrix<Type> c({ n, n }, 0);
+
+	//Every pool thread packs once so its buffers exist. A thread takes one chunk and waits
+	//for the others, so no thread can take two
+	auto &pool = ctl::ThreadPool::global();
+	std::vector<ctl::Matrix<Type>> own(pool.size(), c);
+	std::atomic<size_t> arrived{ 0 };
+	pool.parallelFor(pool.size(), [&](const size_t &t)
+	{
+		ctl::gemm(Type(1), a, b, Type(0), own[t], ctl::Parallel{ 1 });
+		++arrived;
+		while (arrived < own.size())
+			std::this_thread::yield();
+	});
+
+	const auto step = [&]
+	{
+		ctl::gemm(Type(1), a, b, Type(0), c, par);
+		ctl::axpy(Type(0.5), a, c, par);
+		ctl::scal(Type(0.5), c);
+		ctl::hadamard(a, c, c);
+	};
+	for (size_t i = 0; i < 10; ++i)
+		step();
+
+	const auto before = g_allocations.load();
+	for (size_t i = 0; i < 100; ++i)
+		step();
+	const auto count = g_allocations.load() - before;
+
+	g_sink = g_sink + double(c.loc(0));
+	std::cout << std::left << std::setw(12) << "allocations" << std::setw(8) << type << std::right << std::setw(6) << n
+		<< std::setw(10) << count << " over 100 iterations on " << pool.size() << " threads\n";
+	return count;
+}
+
+std::string toJson(const std::vector<Result> &results)
+{
+	const char *levels[] = { "SCALAR", "SSE2", "AVX2" };
+
+	std::ostringstream out;
+	out << std::setprecision(9);
+	out << "{\n\t\"simd\": \"" << levels[int(ctl::Simd::level())] << "\",\n\t\"threads\": " << ctl::ThreadPool::global().size() << ",\n\t\"results\": [\n";
+
+	//One case per line, the baseline reader relies on it
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const auto &r = results[i];
+		out << "\t\t{ \"name\": \"" << r.name << "\", \"type\": \"" << r.type << "\", \"size\": " << r.size
+			<< ", \"seconds\": " << r.seconds << ", \"gflops\": " << r.gflops() << ", \"gbs\": " << r.gbs() << " }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+
+	out << "\t]\n}\n";
+	return out.str();
+}
+
+//Value of "key": in a line of toJson's output
+std::string field(const std::string &line, const std::string &key)
+{
+	const auto at = line.find('"' + key + "\":");
+	if (at == std::string::npos)
+		return "";
+
+	auto begin = line.find_first_not_of(" \"", at + key.size() + 3);
+	const auto end = line.find_first_of("\",}", begin);
+	return line.substr(begin, end - begin);
+}
+
+//Cases slower than the baseline by more than the tolerance, printed and counted.
+//A baseline that can't be read, has a malformed case or shares no case with this run counts as one
+size_t compare(const std::vector<Result> &results, const Options &options)
+{
+	std::ifstream file(options.baseline);
+	if (!file)
+	{
+		std::cerr << "Can't open baseline " << options.baseline << '\n';
+		return 1;
+	}
+
+	const char *levels[] = { "SCALAR", "SSE2", "AVX2" };
+	const std::string simd = levels[int(ctl::Simd::level())], threads = std::to_string(ctl::ThreadPool::global().size());
+
+	size_t slower = 0, matched = 0, number = 0;
+	std::cout << "\nAgainst " << options.baseline << ":\n";
+
+	for (std::string line; std::getline(file, line);)
+	{
+		++number;
+
+		const auto baseSimd = field(line, "simd"), baseThreads = field(line, "threads");
+		if (!baseSimd.empty() && baseSimd != simd)
+			std::cerr << "Warning: baseline ran on " << baseSimd << ", this run on " << simd << '\n';
+		if (!baseThreads.empty() && baseThreads != threads)
+			std::cerr << "Warning: baseline ran on " << baseThreads << " threads, this run on " << threads << '\n';
+
+		if (line.find("\"name\":") == std::string::npos)
+			continue;
+
+		const auto name = field(line, "name"), type = field(line, "type"), size = field(line, "size"), seconds = field(line, "seconds");
+		double baseSeconds = 0;
+		try { baseSeconds = std::stod(seconds); }
+		catch (const std::exception &) {}
+		if (name.empty() || type.empty() || size.empty() || !(baseSeconds > 0))
+		{
+			std::cerr << "Malformed case on line " << number << " of baseline " << options.baseline << '\n';
+			return slower + 1;
+		}
+
+		const auto found = std::find_if(results.begin(), results.end(), [&](const Result &r)
+		{
+			return r.name == name && r.type == type && std::to_string(r.size) == size;
+		});
+		if (found == results.end())
+			continue;
+
+		++matched;
+		const auto ratio = found->seconds / baseSeconds;
+		if (ratio > 1 + options.tolerance)
+		{
+			++slower;
+			std::cout << "  SLOWER  " << name << ' ' << type << ' ' << size << ": " << std::fixed << std::setprecision(2) << ratio << "x the time\n";
+		}
+	}
+
+	std::cout << "  " << matched << " cases compared, " << slower << " slower than " << std::fixed << std::setprecision(0) << options.tolerance * 100 << "% allows\n";
+	if (matched == 0)
+	{
+		std::cerr << "No case of baseline " << options.baseline << " was run, check it and --max-size and --filter\n";
+		return 1;
+	}
+
+	return slower;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--allocations")
+		{
+			options.allocations = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value for " << arg << '\n';
+			return 2;
+		}
+
+		const std::string value = argv[++i];
+		if (arg == "--json")
+			options.json = value;
+		else if (arg == "--baseline")
+			options.baseline = value;
+		else if (arg == "--tolerance")
+			options.tolerance = std::stod(value);
+		else if (arg == "--max-size")
+			options.maxSize = std::stoul(value);
+		else if (arg == "--min-time")
+			options.minTime = std::stod(value);
+		else if (arg == "--filter")
+			options.filter = value;
+		else
+		{
+			std::cerr << "Unknown option " << arg << '\n';
+			return 2;
+		}
+	}
+
+	if (options.allocations)
+	{
+		if (ctl::ThreadPool::global().size() == 1)
+			std::cerr << "Warning: the pool has one thread, the threaded path isn't checked\n";
+
+		const auto count = countAllocations<float>("float") + countAllocations<double>("double");
+		return count == 0 ? 0 : 1;
+	}
+
+	std::vector<Result> results;
+	runType<float>("float", options, results);
+	runType<double>("double", options, results);
+
+	if (options.json == "-")
+		std::cout << toJson(results);
+	else if (!options.json.empty())
+		std::ofstream(options.json) << toJson(results);
+
+	if (!options.baseline.empty() && compare(results, options) != 0)
+		return 1;
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "Simd.h"
+#include "Error.h"
+
+//Activation functions of NeuralNet layers. A layer's outputs are row major with a row per neuron and
+//a column per sample, so every activation but SOFTMAX works on all of them as one array.
+
+namespace ctl
+{
+	//SIGMOID, TANH and SOFTMAX are within a few ulp of std::exp based versions, FAST_SIGMOID within 1e-6 of SIGMOID
+	enum class Activation : uint8_t { SIGMOID, FAST_SIGMOID, TANH, RELU, SOFTMAX };
+
+	//Softmax of each column, the rows are combined elementwise so the work stays in registers
+	inline void _softmaxColumns_(double *a, const size_t &width, const size_t &height)
+	{
+		if (width == 1)
+			return Simd::softmax(a, height);
+		if (width * height == 0)
+			return;
+
+		thread_local std::vector<double> scratch;
+		scratch.resize(width);
+
+		//Shift each column by its largest so nothing overflows
+		std::copy(a, a + width, scratch.data());
+		for (size_t y = 1; y < height; ++y)
+			Simd::arith<Simd::Max>(a + y * width, scratch.data(), scratch.data(), width);
+		for (size_t y = 0; y < height; ++y)
+			Simd::arith<Simd::Sub>(a + y * width, scratch.data(), a + y * width, width);
+
+		Simd::activate<Simd::Exp>(a, width * height);
+
+		std::copy(a, a + width, scratch.data());
+		for (size_t y = 1; y < height; ++y)
+			Simd::arith<Simd::Add>(a + y * width, scratch.data(), scratch.data(), width);
+		for (size_t y = 0; y < height; ++y)
+			Simd::arith<Simd::Div>(a + y * width, scratch.data(), a + y * width, width);
+	}
+
+	//In place over height neurons of width samples
+	inline void activate(const Activation &act, double *a, const size_t &width, const size_t &height)
+	{
+		const auto n = width * height;
+
+		switch (act)
+		{
+		case Activation::SIGMOID:
+			return Simd::activate<Simd::Sigmoid>(a, n);
+		case Activation::FAST_SIGMOID:
+			return Simd::activate<Simd::FastSigmoid>(a, n);
+		case Activation::TANH:
+			return Simd::activate<Simd::Tanh>(a, n);
+		case Activation::RELU:
+			return Simd::activate<Simd::Relu>(a, n);
+		case Activation::SOFTMAX:
+			return _softmaxColumns_(a, width, height);
+		}
+
+		throw Log("Activation: activate: unknown activation.", Log::Severity::ERR0R);
+	}
+
+	//Takes error back through the activation that gave out, both height neurons of width samples.
+	//SOFTMAX mixes a column's neurons: error_i = out_i * (error_i - sum_j error_j * out_j)
+	inline void derive(const Activation &act, const double *out, double *error, const size_t &width, const size_t &height)
+	{
+		const auto n = width * height;
+
+		switch (act)
+		{
+		case Activation::SIGMOID:
+		case Activation::FAST_SIGMOID:
+			return Simd::derive<Simd::Sigmoid>(out, error, n);
+		case Activation::TANH:
+			return Simd::derive<Simd::Tanh>(out, error, n);
+		case Activation::RELU:
+			return Simd::derive<Simd::Relu>(out, error, n);
+		case Activation::SOFTMAX:
+		{
+			thread_local std::vector<double> dot;
+			dot.assign(width, 0.);
+
+			for (size_t y = 0; y < height; ++y)
+				for (size_t x = 0; x < width; ++x)
+					dot[x] += error[x + y * width] * out[x + y * width];
+			for (size_t y = 0; y < height; ++y)
+				for (size_t x = 0; x < width; ++x)
+					error[x + y * width] = out[x + y * width] * (error[x + y * width] - dot[x]);
+			return;
+		}
+		}
+
+		throw Log("Activation: derive: unknown activation.", Log::Severity::ERR0R);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+
+namespace ctl
+{
+	//Cache line, also the widest SIMD register
+	constexpr size_t CACHE_LINE = 64;
+
+	//Every allocation starts on an Alignment boundary
+	template<typename Type, size_t Alignment = CACHE_LINE>
+	class AlignedAllocator
+	{
+		static_assert(Alignment >= alignof(Type) && (Alignment & (Alignment - 1)) == 0, "AlignedAllocator: alignment must be a power of two no smaller than the type's.");
+
+	public:
+		using value_type = Type;
+		using is_always_equal = std::true_type;
+
+		template<typename U>
+		struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+		AlignedAllocator() = default;
+		template<typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+		Type* allocate(const size_t &n)
+		{
+			return static_cast<Type*>(::operator new(n * sizeof(Type), std::align_val_t(Alignment)));
+		}
+
+		void deallocate(Type *p, const size_t &)
+		{
+			::operator delete(p, std::align_val_t(Alignment));
+		}
+
+		template<typename U>
+		bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+		template<typename U>
+		bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+	};
+
+	//Bump allocator, memory is only given back all at once by reset or rewind.
+	//Blocks are kept after a reset so a repeated workload stops allocating.
+	//Not thread safe, use one per thread.
+	class Arena
+	{
+	public:
+		//Position to rewind to
+		struct Marker
+		{
+			size_t block;
+			size_t offset;
+		};
+
+		//Rewinds the arena and makes it current for this thread until destroyed
+		class Scope
+		{
+		public:
+			Scope(Arena &arena)
+				: m_arena(arena)
+				, m_marker(arena.mark())
+				, m_previous(_current_())
+			{
+				_current_() = &arena;
+			}
+
+			Scope(const Scope &) = delete;
+			Scope& operator=(const Scope &) = delete;
+
+			~Scope()
+			{
+				_current_() = m_previous;
+				m_arena.rewind(m_marker);
+			}
+
+		private:
+			Arena &m_arena;
+			Marker m_marker;
+			Arena *m_previous;
+		};
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		Arena(const size_t &blockSize = size_t(1) << 20)
+			: m_blockSize(blockSize)
+		{
+		}
+
+		Arena(const Arena &) = delete;
+		Arena& operator=(const Arena &) = delete;
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//Arena of the innermost Scope on this thread, nullptr outside of one
+		static Arena* current() { return _current_(); }
+
+		void* allocate(const size_t &bytes, const size_t &alignment = CACHE_LINE)
+		{
+			while (m_block < m_blocks.size())
+			{
+				auto &block = m_blocks[m_block];
+				const auto offset = (m_offset + alignment - 1) / alignment * alignment;
+
+				if (offset + bytes <= block.size)
+				{
+					m_offset = offset + bytes;
+					return block.data.get() + offset;
+				}
+
+				++m_block;
+				m_offset = 0;
+			}
+
+			//Blocks are cache line aligned so offsets keep any smaller alignment
+			const auto size = std::max(m_blockSize, bytes + alignment);
+			m_blocks.push_back({ std::unique_ptr<std::byte[], _Free_>(static_cast<std::byte*>(::operator new(size, std::align_val_t(CACHE_LINE)))), size });
+
+			m_block = m_blocks.size() - 1;
+			m_offset = bytes;
+			return m_blocks.back().data.get();
+		}
+
+		//Only the latest allocation is given back, so a growing vector reuses its space
+		void deallocate(void *p, const size_t &bytes)
+		{
+			if (m_block < m_blocks.size() && static_cast<std::byte*>(p) + bytes == m_blocks[m_block].data.get() + m_offset)
+				m_offset -= bytes;
+		}
+
+		Marker mark() const { return { m_block, m_offset }; }
+
+		void rewind(const Marker &marker)
+		{
+			m_block = marker.block;
+			m_offset = marker.offset;
+		}
+
+		void reset() { rewind({ 0, 0 }); }
+
+		//Bytes held by the arena, used or not
+		size_t capacity() const
+		{
+			size_t size = 0;
+			for (const auto &i : m_blocks)
+				size += i.size;
+			return size;
+		}
+
+	private:
+		struct _Free_ { void operator()(std::byte *p) const { ::operator delete(p, std::align_val_t(CACHE_LINE)); } };
+
+		struct _Block_
+		{
+			std::unique_ptr<std::byte[], _Free_> data;
+			size_t size;
+		};
+
+		static Arena*& _current_()
+		{
+			thread_local Arena *arena = nullptr;
+			return arena;
+		}
+
+		std::vector<_Block_> m_blocks;
+		size_t m_block = 0;
+		size_t m_offset = 0;
+		size_t m_blockSize;
+	};
+
+	//Allocates from an Arena, a default constructed one binds to Arena::current() so
+	//containers made inside an Arena::Scope need no arguments:
+	//
+	//	ctl::Arena arena;
+	//	{
+	//		ctl::Arena::Scope scope(arena);
+	//		ctl::Matrix<double, ctl::ArenaAllocator<double>> m({ 64, 64 }, 0);
+	//	}
+	//
+	//Whatever is allocated in a scope must be destroyed before it ends.
+	//Outside of any scope it falls back to cache line aligned heap memory.
+	template<typename Type>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = Type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+
+		ArenaAllocator() : m_arena(Arena::current()) {}
+		ArenaAllocator(Arena &arena) : m_arena(&arena) {}
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U> &a) : m_arena(a.arena()) {}
+
+		Type* allocate(const size_t &n)
+		{
+			if (m_arena)
+				return static_cast<Type*>(m_arena->allocate(n * sizeof(Type), std::max(CACHE_LINE, alignof(Type))));
+
+			return static_cast<Type*>(::operator new(n * sizeof(Type), std::align_val_t(std::max(CACHE_LINE, alignof(Type)))));
+		}
+
+		void deallocate(Type *p, const size_t &n)
+		{
+			if (m_arena)
+				m_arena->deallocate(p, n * sizeof(Type));
+			else
+				::operator delete(p, std::align_val_t(std::max(CACHE_LINE, alignof(Type))));
+		}
+
+		Arena* arena() const { return m_arena; }
+
+		template<typename U>
+		bool operator==(const ArenaAllocator<U> &a) const { return m_arena == a.arena(); }
+		template<typename U>
+		bool operator!=(const ArenaAllocator<U> &a) const { return m_arena != a.arena(); }
+
+	private:
+		Arena *m_arena;
+	};
+}
\ No newline at end of file
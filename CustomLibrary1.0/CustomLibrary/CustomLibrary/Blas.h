@@ -0,0 +1,195 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "Error.h"
+
+//BLAS style operations that write into existing storage.
+//Outputs are a Matrix or a writable MatrixView of the right size, they are never reallocated
+//and a wrong size throws. Inputs are Matrices or views, and may be read only.
+//Once every thread's packing buffers exist they don't allocate, on one thread or on the pool,
+//which MatrixBenchmark --allocations checks.
+
+namespace ctl
+{
+	//Memory [first, last) an operand can reach
+	template<typename M>
+	auto _extentOf_(const M &m)
+	{
+		if constexpr (_is_matrix_<M>)
+			return std::make_pair(m.data().data(), m.data().data() + m.data().size());
+		else
+			return m._extent_();
+	}
+
+	template<typename M1, typename M2>
+	bool _sharesMemory_(const M1 &a, const M2 &b)
+	{
+		const auto x = _extentOf_(a), y = _extentOf_(b);
+		return x.first < y.second && y.first < x.second;
+	}
+
+	//Writable element pointer and its { row, column } strides
+	template<typename M>
+	auto _targetOf_(M &m)
+	{
+		using Type = typename std::decay_t<M>::value_type;
+
+		if constexpr (_is_matrix_<M>)
+			return std::make_pair(&m.loc(0), NumVec<size_t, 2>{ m.dim()[0], size_t(1) });
+		else
+			return std::make_pair(static_cast<Type*>(m.ptr() + m.offset()), NumVec<size_t, 2>{ m.stride()[1], m.stride()[0] });
+	}
+
+	//-------------------------------------------------------------------------------
+	//---------------------------------Level 3---------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//c = alpha * a x b + beta * c
+	//c must not overlap a or b. When beta is 0 the old contents of c are ignored, even NaNs.
+	template<typename Type, typename A, typename B, typename C>
+	void gemm(const Type &alpha, const A &a, const B &b, const Type &beta, C &&c, const Parallel &par = Parallel::global())
+	{
+		static_assert((_is_matrix_<A> || _is_matrix_view_<A>) && (_is_matrix_<B> || _is_matrix_view_<B>), "Blas: gemm: operands must be matrices or views.");
+		static_assert(std::is_same_v<Type, typename std::decay_t<C>::value_type>, "Blas: gemm: element types differ.");
+
+		const auto m = a.dim()[1], n = b.dim()[0], k = a.dim()[0];
+
+		if (k != b.dim()[1])
+			throw Log("Blas: gemm: width not same as height.", Log::Severity::ERR0R);
+		if (c.dim() != NumVec<size_t, 2>{ n, m })
+			throw Log("Blas: gemm: output size differs.", Log::Severity::ERR0R);
+		if (m * n == 0)
+			return;
+		if ((m * k != 0 && _sharesMemory_(a, c)) || (n * k != 0 && _sharesMemory_(b, c)))
+			throw Log("Blas: gemm: output overlaps an operand.", Log::Severity::ERR0R);
+
+		if (beta == Type(0))
+			c = Type(0);
+		else if (beta != Type(1))
+			c *= beta;
+
+		if (alpha == Type(0) || k == 0)
+			return;
+
+		const auto to = _targetOf_(c);
+		const auto opA = _gemmOperandOf_(a), opB = _gemmOperandOf_(b);
+
+		if (to.second[1] == 1)
+			_gemmParallel_(m, n, k, opA, opB, to.first, to.second[0], par, alpha);
+		//Transposed output, c^T = b^T x a^T
+		else if (to.second[0] == 1)
+			_gemmParallel_(n, m, k, GemmOperand<Type>{ opB.ptr, opB.col, opB.row }, GemmOperand<Type>{ opA.ptr, opA.col, opA.row }, to.first, to.second[1], par, alpha);
+		else
+			throw Log("Blas: gemm: output needs a unit stride.", Log::Severity::ERR0R);
+	}
+
+	//Largest m * n * k multiplied by the interleaved batch kernel, bigger products are packed one by one
+	constexpr size_t BATCH_INTERLEAVE = 16 * 16 * 16;
+
+	//c[e] = a[e] x b[e] for count products of equally shaped matrices, each row major and stored back to back.
+	//sizeA and sizeB are { width, height } like Matrix::dim, c holds count results and is overwritten.
+	//Each element sums its products in order like a naive loop, entries are split over the pool
+	template<typename Type>
+	void gemmBatched(const size_t &count, const NumVec<size_t, 2> &sizeA, const Type *a, const NumVec<size_t, 2> &sizeB, const Type *b, Type *c, const Parallel &par = Parallel::global())
+	{
+		const auto m = sizeA[1], n = sizeB[0], k = sizeA[0];
+
+		if (k != sizeB[1])
+			throw Log("Blas: gemmBatched: width not same as height.", Log::Severity::ERR0R);
+		if (count * m * n == 0)
+			return;
+		if (k == 0)
+			return std::fill(c, c + count * m * n, Type(0));
+
+		const auto entries = [a, b, c, m, n, k](const size_t &begin, const size_t &end)
+		{
+			if (m * n * k <= BATCH_INTERLEAVE)
+			{
+				thread_local std::vector<Type> work;
+				work.resize((m * k + k * n + m * n) * Simd::MAX_WIDTH<Type>);
+				return Simd::batch(a + begin * m * k, b + begin * k * n, c + begin * m * n, m, n, k, end - begin, work.data());
+			}
+
+			for (size_t e = begin; e < end; ++e)
+			{
+				std::fill(c + e * m * n, c + (e + 1) * m * n, Type(0));
+				_gemm_(m, n, k, GemmOperand<Type>{ a + e * m * k, k, 1 }, GemmOperand<Type>{ b + e * k * n, n, 1 }, c + e * m * n, n);
+			}
+		};
+
+		const auto threads = std::min(par.count(count * m * n * k), count);
+		if (threads <= 1)
+			return entries(0, count);
+
+		ThreadPool::global().parallelRange(count, threads, entries);
+	}
+
+	//Same with the batches in vectors, the entry count comes from a and every size is checked
+	template<typename Type>
+	void gemmBatched(const NumVec<size_t, 2> &sizeA, const std::vector<Type> &a, const NumVec<size_t, 2> &sizeB, const std::vector<Type> &b, std::vector<Type> &c, const Parallel &par = Parallel::global())
+	{
+		const auto count = sizeA.product() ? a.size() / sizeA.product() : 0;
+
+		if (a.size() != count * sizeA.product() || b.size() != count * sizeB.product() || c.size() != count * sizeA[1] * sizeB[0])
+			throw Log("Blas: gemmBatched: batch sizes differ.", Log::Severity::ERR0R);
+
+		gemmBatched(count, sizeA, a.data(), sizeB, b.data(), c.data(), par);
+	}
+
+	//-------------------------------------------------------------------------------
+	//---------------------------------Level 1---------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//y += alpha * x
+	template<typename Type, typename X, typename Y>
+	void axpy(const Type &alpha, const X &x, Y &&y, const Parallel &par = Parallel::global())
+	{
+		static_assert(_is_matrix_operand_<X> && (_is_matrix_<Y> || _is_matrix_view_<Y>), "Blas: axpy: operands must be matrices or views.");
+
+		if (x.dim() != y.dim())
+			throw Log("Blas: axpy: size differs.", Log::Severity::ERR0R);
+		if (x.dim().product() == 0)
+			return;
+
+		if constexpr (!_is_matrix_expr_<X>)
+			if (_contiguousOf_(x) && _contiguousOf_(y) && (!_sharesMemory_(x, y) || &x.loc(0) == &y.loc(0)))
+			{
+				const auto *from = &x.loc(0);
+				auto *to = &y.loc(0);
+				return _parallelElements_(x.dim().product(), [alpha, from, to](const size_t &begin, const size_t &end)
+				{
+					Simd::axpy(alpha, from + begin, to + begin, end - begin);
+				}, par);
+			}
+
+		y += x * alpha;
+	}
+
+	//x *= alpha
+	template<typename Type, typename X>
+	void scal(const Type &alpha, X &&x)
+	{
+		static_assert(_is_matrix_<X> || _is_matrix_view_<X>, "Blas: scal: operand must be a matrix or view.");
+
+		x *= alpha;
+	}
+
+	//out = a * b elementwise, out may be a or b
+	template<typename A, typename B, typename Out>
+	void hadamard(const A &a, const B &b, Out &&out)
+	{
+		static_assert(_is_matrix_operand_<A> && _is_matrix_operand_<B> && (_is_matrix_<Out> || _is_matrix_view_<Out>), "Blas: hadamard: operands must be matrices or views.");
+
+		if (a.dim() != b.dim() || a.dim() != out.dim())
+			throw Log("Blas: hadamard: size differs.", Log::Severity::ERR0R);
+
+		out = a * b;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Error.h"
+
+//Storage only matrices of 16 or 8 bit elements. Elements are widened to float when read
+//and products sum in float, so large weights move 2 to 4 times less memory.
+
+namespace ctl
+{
+	enum class Precision { FLOAT16, BFLOAT16, INT8 };
+
+	template<Precision P>
+	using _precisionFormat_ = std::conditional_t<P == Precision::FLOAT16, Simd::F16, std::conditional_t<P == Precision::BFLOAT16, Simd::BF16, Simd::I8>>;
+
+	//Row major, INT8 rows are scaled so their largest magnitude maps to 127
+	template<Precision P>
+	class CompactMatrix
+	{
+	public:
+		using Format = _precisionFormat_<P>;
+		using storage = typename Format::storage;
+		using value_type = float;
+
+		//Rows decoded at a time when multiplying by a Matrix, sized to stay in L2
+		static constexpr size_t PANEL = 64;
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		CompactMatrix() = default;
+		CompactMatrix(const CompactMatrix &) = default;
+		CompactMatrix(CompactMatrix &&) = default;
+
+		//Rounds a Matrix, view or expression of any arithmetic type
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		explicit CompactMatrix(const M &mat)
+			: m_data(mat.dim().product())
+			, m_scale(P == Precision::INT8 ? mat.dim()[1] : 0)
+			, m_dim(mat.dim())
+		{
+			std::vector<float> row(m_dim[0]);
+
+			for (size_t y = 0; y < m_dim[1]; ++y)
+			{
+				float largest = 0;
+				for (size_t x = 0; x < m_dim[0]; ++x)
+				{
+					row[x] = float(mat(x, y));
+					largest = std::max(largest, std::fabs(row[x]));
+				}
+
+				float inverse = 1;
+				if constexpr (P == Precision::INT8)
+				{
+					m_scale[y] = largest > 0 ? largest / 127 : 1;
+					inverse = 1 / m_scale[y];
+				}
+
+				Simd::narrow<Format>(row.data(), inverse, m_data.data() + y * m_dim[0], m_dim[0]);
+			}
+		}
+
+		//---------------------------------------------------------
+		//----------------------Operators--------------------------
+		//---------------------------------------------------------
+
+		CompactMatrix& operator=(const CompactMatrix &) = default;
+		CompactMatrix& operator=(CompactMatrix &&) = default;
+
+		float operator()(const size_t &x, const size_t &y) const { return scale(y) * Format::decode(m_data[x + m_dim[0] * y]); }
+
+		const auto& dim() const { return m_dim; }
+		const auto& data() const { return m_data; }
+
+		//Multiplier of row y, 1 unless INT8
+		float scale(const size_t &y) const
+		{
+			if constexpr (P == Precision::INT8)
+				return m_scale[y];
+			else
+				return 1;
+		}
+
+		//Bytes of element storage
+		size_t bytes() const { return m_data.size() * sizeof(storage) + m_scale.size() * sizeof(float); }
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//to = this x v, v has width elements and to has height. Doesn't allocate.
+		//Rows are split over the pool, INT8 rows are scaled after their dot product
+		void dotProduct(const float *v, float *to, const Parallel &par = Parallel::global()) const
+		{
+			const auto rows = [this, v, to](const size_t &begin, const size_t &end)
+			{
+				Simd::dotWiden<Format>(m_data.data() + begin * m_dim[0], m_dim[0], end - begin, v, m_dim[0], to + begin);
+
+				if constexpr (P == Precision::INT8)
+					for (size_t y = begin; y < end; ++y)
+						to[y] *= m_scale[y];
+			};
+
+			const auto threads = std::min(par.count(m_data.size()), m_dim[1]);
+			if (threads <= 1)
+				return rows(0, m_dim[1]);
+
+			ThreadPool::global().parallelRange(m_dim[1], threads, rows);
+		}
+
+		auto dotProduct(const std::vector<float> &v, const Parallel &par = Parallel::global()) const
+		{
+			if (m_dim[0] != v.size())
+				throw Log("CompactMatrix: dotProduct: width not same as vector size.", Log::Severity::ERR0R);
+
+			std::vector<float> result(m_dim[1]);
+			dotProduct(v.data(), result.data(), par);
+			return result;
+		}
+
+		//this x mat2, mat2 is a float Matrix, view or expression.
+		//A single column is a GEMV, wider operands decode PANEL rows to float and use the packed multiply
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto dotProduct(const M &mat2, const Parallel &par = Parallel::global()) const
+		{
+			static_assert(std::is_same_v<float, typename std::decay_t<M>::value_type>, "CompactMatrix: dotProduct: operand must be float.");
+
+			if constexpr (_is_matrix_expr_<M>)
+				return dotProduct(typename std::decay_t<M>::matrix_type(mat2), par);
+			else
+			{
+				if (m_dim[0] != mat2.dim()[1])
+					throw Log("CompactMatrix: dotProduct: width not same as height.", Log::Severity::ERR0R);
+
+				const auto n = mat2.dim()[0];
+				Matrix<float> mat({ n, m_dim[1] }, 0);
+				if (mat.dim().product() == 0)
+					return mat;
+
+				const auto b = _gemmOperandOf_(mat2);
+				auto *c = &mat.loc(0);
+
+				if (n == 1)
+				{
+					if (b.row == 1)
+						dotProduct(b.ptr, c, par);
+					else
+					{
+						std::vector<float> v(m_dim[0]);
+						for (size_t i = 0; i < v.size(); ++i)
+							v[i] = b(i, 0);
+						dotProduct(v.data(), c, par);
+					}
+					return mat;
+				}
+
+				const auto panels = (m_dim[1] + PANEL - 1) / PANEL;
+				const auto work = [this, &b, c, n](const size_t &begin, const size_t &end)
+				{
+					thread_local std::vector<float> panel;
+					panel.resize(PANEL * m_dim[0]);
+
+					for (size_t p = begin; p < end; ++p)
+					{
+						const auto y = p * PANEL, rows = std::min(PANEL, m_dim[1] - y);
+						for (size_t i = 0; i < rows; ++i)
+							Simd::widen<Format>(m_data.data() + (y + i) * m_dim[0], scale(y + i), panel.data() + i * m_dim[0], m_dim[0]);
+
+						_gemm_(rows, n, m_dim[0], GemmOperand<float>{ panel.data(), m_dim[0], 1 }, b, c + y * n, n);
+					}
+				};
+
+				const auto threads = std::min(par.count(m_data.size() * n), panels);
+				if (threads <= 1)
+					work(0, panels);
+				else
+					ThreadPool::global().parallelRange(panels, threads, work);
+
+				return mat;
+			}
+		}
+
+		auto toMatrix() const
+		{
+			Matrix<float> mat({ m_dim[0], m_dim[1] }, 0);
+			if (mat.dim().product() == 0)
+				return mat;
+
+			for (size_t y = 0; y < m_dim[1]; ++y)
+				Simd::widen<Format>(m_data.data() + y * m_dim[0], scale(y), &mat.loc(y * m_dim[0]), m_dim[0]);
+
+			return mat;
+		}
+
+	private:
+		std::vector<storage> m_data;
+		std::vector<float> m_scale;
+		NumVec<size_t, 2> m_dim = { 0, 0 };
+	};
+
+	using HalfMatrix = CompactMatrix<Precision::FLOAT16>;
+	using BFloat16Matrix = CompactMatrix<Precision::BFLOAT16>;
+	using Int8Matrix = CompactMatrix<Precision::INT8>;
+}
\ No newline at end of file
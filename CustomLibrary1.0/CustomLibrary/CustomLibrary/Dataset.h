@@ -0,0 +1,461 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <utility>
+#include <algorithm>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#include "NeuralNet.h"
+#include "MatrixFile.h"
+#include "Error.h"
+
+//Datasets read from disk a batch at a time, for data that doesn't fit in memory.
+//A background thread reads, decodes and shuffles the next batch while the current one trains:
+//
+//	ctl::DatasetStream stream(ctl::openDataset("train.ctld"), 64, 4096);
+//	for (size_t epoch = 0; epoch < 10; ++epoch, stream.rewind())
+//		while (const auto *batch = stream.next())
+//			net.trainBatch(batch->begin(), batch->end(), 0.1);
+
+namespace ctl
+{
+	//Binary datasets: this header, then per sample its inputs as doubles and its targets as one byte each
+	struct DatasetFileHeader
+	{
+		static constexpr uint32_t VERSION = 1;
+
+		char magic[4] = { 'C', 'T', 'L', 'D' };
+		uint32_t version = VERSION;
+		uint32_t endian = MatrixFileHeader::ENDIAN;
+		uint32_t reserved0 = 0;
+		uint64_t inputs = 0;
+		uint64_t outputs = 0;
+		uint64_t count = 0;
+		uint8_t reserved1[24] = {};
+	};
+	static_assert(sizeof(DatasetFileHeader) == 64 && std::is_trivially_copyable_v<DatasetFileHeader>, "Dataset: header layout.");
+
+	//Writes [begin, end) as a binary dataset, every sample must have the sizes of the first
+	template<typename Iter, typename = typename std::enable_if_t<std::is_same_v<typename std::iterator_traits<Iter>::value_type, NeuralNet::Data>>>
+	void saveDataset(const std::string &path, Iter begin, const Iter &end)
+	{
+		std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file)
+			throw Log("Dataset: saveDataset: can't open " + path + '.', Log::Severity::ERR0R);
+
+		DatasetFileHeader header;
+		if (begin != end)
+		{
+			header.inputs = begin->first.size();
+			header.outputs = begin->second.size();
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<char> record(header.inputs * sizeof(double) + header.outputs);
+		for (; begin != end; ++begin, ++header.count)
+		{
+			if (begin->first.size() != header.inputs || begin->second.size() != header.outputs)
+				throw Log("Dataset: saveDataset: samples differ in size.", Log::Severity::ERR0R);
+
+			std::memcpy(record.data(), begin->first.data(), header.inputs * sizeof(double));
+			for (size_t i = 0; i < header.outputs; ++i)
+				record[header.inputs * sizeof(double) + i] = char(begin->second[i]);
+			file.write(record.data(), record.size());
+		}
+
+		//The count is known once every sample is written
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		if (!file)
+			throw Log("Dataset: saveDataset: write failed for " + path + '.', Log::Severity::ERR0R);
+	}
+
+	//Sequential source of samples
+	class DatasetReader
+	{
+	public:
+		virtual ~DatasetReader() = default;
+
+		//Fills d with the next sample, reusing its vectors. False at the end
+		virtual bool read(NeuralNet::Data &d) = 0;
+		//Back to the first sample
+		virtual void rewind() = 0;
+
+		virtual size_t inputs() const = 0;
+		virtual size_t outputs() const = 0;
+	};
+
+	//Reads binary datasets in blocks of BLOCK bytes, swapping bytes for files of the other order
+	class BinaryDatasetReader : public DatasetReader
+	{
+	public:
+		static constexpr size_t BLOCK = size_t(1) << 20;
+
+		BinaryDatasetReader(const std::string &path)
+			: m_file(path, std::ios::in | std::ios::binary)
+		{
+			if (!m_file || !m_file.read(reinterpret_cast<char*>(&m_header), sizeof(m_header)))
+				throw Log("Dataset: BinaryDatasetReader: can't read " + path + '.', Log::Severity::ERR0R);
+			if (std::memcmp(m_header.magic, "CTLD", 4) != 0)
+				throw Log("Dataset: BinaryDatasetReader: not a dataset file.", Log::Severity::ERR0R);
+
+			m_swap = m_header.endian != MatrixFileHeader::ENDIAN;
+			if (m_swap)
+			{
+				if (_byteSwap_(m_header.endian) != MatrixFileHeader::ENDIAN)
+					throw Log("Dataset: BinaryDatasetReader: unknown byte order.", Log::Severity::ERR0R);
+
+				m_header.version = _byteSwap_(m_header.version);
+				m_header.inputs = _byteSwap_(m_header.inputs);
+				m_header.outputs = _byteSwap_(m_header.outputs);
+				m_header.count = _byteSwap_(m_header.count);
+			}
+			if (m_header.version > DatasetFileHeader::VERSION)
+				throw Log("Dataset: BinaryDatasetReader: newer file version.", Log::Severity::ERR0R);
+
+			//A crafted header could wrap the sample size or claim more samples than the file holds,
+			//sizes are compared by division so they can't wrap
+			if (m_header.outputs > SIZE_MAX || m_header.inputs > (SIZE_MAX - m_header.outputs) / sizeof(double))
+				throw Log("Dataset: BinaryDatasetReader: sample size is too large.", Log::Severity::ERR0R);
+			m_record = m_header.inputs * sizeof(double) + m_header.outputs;
+			if (m_header.count != 0 && m_record == 0)
+				throw Log("Dataset: BinaryDatasetReader: samples have no values.", Log::Severity::ERR0R);
+
+			m_file.seekg(0, std::ios::end);
+			const uint64_t data = uint64_t(m_file.tellg()) - sizeof(m_header);
+			m_file.seekg(sizeof(m_header));
+			if (m_header.count != 0 && data / m_record < m_header.count)
+				throw Log("Dataset: BinaryDatasetReader: file is truncated.", Log::Severity::ERR0R);
+
+			m_block.resize(std::min<uint64_t>(m_header.count, std::max<size_t>(1, BLOCK / std::max<size_t>(1, m_record))) * m_record);
+		}
+
+		bool read(NeuralNet::Data &d) override
+		{
+			if (m_read == m_header.count)
+				return false;
+
+			if (m_at == m_filled)
+			{
+				const auto records = std::min<uint64_t>(m_block.size() / m_record, m_header.count - m_read);
+				if (!m_file.read(m_block.data(), records * m_record))
+					throw Log("Dataset: BinaryDatasetReader: file is truncated.", Log::Severity::ERR0R);
+				m_at = 0;
+				m_filled = records * m_record;
+			}
+
+			const auto *record = m_block.data() + m_at;
+			d.first.resize(m_header.inputs);
+			d.second.resize(m_header.outputs);
+
+			std::memcpy(d.first.data(), record, m_header.inputs * sizeof(double));
+			if (m_swap)
+				for (auto &i : d.first)
+					i = _byteSwap_(i);
+			for (size_t i = 0; i < m_header.outputs; ++i)
+				d.second[i] = record[m_header.inputs * sizeof(double) + i] != 0;
+
+			m_at += m_record;
+			++m_read;
+			return true;
+		}
+
+		void rewind() override
+		{
+			m_file.clear();
+			m_file.seekg(sizeof(DatasetFileHeader));
+			m_read = m_at = m_filled = 0;
+		}
+
+		size_t inputs() const override { return m_header.inputs; }
+		size_t outputs() const override { return m_header.outputs; }
+		size_t size() const { return m_header.count; }
+
+	private:
+		std::ifstream m_file;
+		DatasetFileHeader m_header;
+		bool m_swap = false;
+
+		//Bytes of a sample
+		size_t m_record = 0;
+		std::vector<char> m_block;
+		size_t m_at = 0, m_filled = 0;
+		uint64_t m_read = 0;
+	};
+
+	//One sample per line, its inputs then its targets separated by commas. Targets are true unless 0.
+	//Blank lines are skipped, as is the first line when it's a header
+	class CsvDatasetReader : public DatasetReader
+	{
+	public:
+		CsvDatasetReader(const std::string &path, const size_t &inputs, const size_t &outputs, const bool &header = false)
+			: m_file(path, std::ios::in | std::ios::binary)
+			, m_inputs(inputs)
+			, m_outputs(outputs)
+			, m_header(header)
+		{
+			if (!m_file)
+				throw Log("Dataset: CsvDatasetReader: can't open " + path + '.', Log::Severity::ERR0R);
+
+			rewind();
+		}
+
+		bool read(NeuralNet::Data &d) override
+		{
+			while (std::getline(m_file, m_text))
+			{
+				++m_line;
+				if (m_text.find_first_not_of(" \t\r") == std::string::npos)
+					continue;
+
+				d.first.resize(m_inputs);
+				d.second.resize(m_outputs);
+
+				const char *at = m_text.c_str(), *last = at;
+				for (size_t i = 0; i < m_inputs + m_outputs; ++i)
+				{
+					char *end;
+					const double value = std::strtod(at, &end);
+					if (end == at || (i + 1 < m_inputs + m_outputs && *end != ','))
+						throw Log("Dataset: CsvDatasetReader: line " + std::to_string(m_line) + " has too few values.", Log::Severity::ERR0R);
+
+					if (i < m_inputs)
+						d.first[i] = value;
+					else
+						d.second[i - m_inputs] = value != 0;
+					last = end;
+					at = end + 1;
+				}
+
+				//Extra columns or text after the last value mean inputs and outputs don't fit the file
+				if (last[std::strspn(last, " \t\r")] != '\0')
+					throw Log("Dataset: CsvDatasetReader: line " + std::to_string(m_line) + " has too many values.", Log::Severity::ERR0R);
+
+				return true;
+			}
+
+			return false;
+		}
+
+		void rewind() override
+		{
+			m_file.clear();
+			m_file.seekg(0);
+			m_line = 0;
+
+			if (m_header && std::getline(m_file, m_text))
+				++m_line;
+		}
+
+		size_t inputs() const override { return m_inputs; }
+		size_t outputs() const override { return m_outputs; }
+
+	private:
+		std::ifstream m_file;
+		std::string m_text;
+		size_t m_inputs, m_outputs;
+		bool m_header;
+		size_t m_line = 0;
+	};
+
+	inline std::unique_ptr<DatasetReader> openDataset(const std::string &path)
+	{
+		return std::make_unique<BinaryDatasetReader>(path);
+	}
+
+	inline std::unique_ptr<DatasetReader> openCsvDataset(const std::string &path, const size_t &inputs, const size_t &outputs, const bool &header = false)
+	{
+		return std::make_unique<CsvDatasetReader>(path, inputs, outputs, header);
+	}
+
+	//Batches of a DatasetReader, read ahead on a background thread into two slots:
+	//one is trained on while the other fills. Samples pass through a shuffle window that
+	//hands out a random one of its samples for each one read, so the order is mixed within
+	//that distance without holding the dataset. Sample vectors are reused, so a steady
+	//stream doesn't allocate
+	class DatasetStream
+	{
+	public:
+		//shuffle is the window in samples, 0 keeps the file order. Same seed, same order
+		DatasetStream(std::unique_ptr<DatasetReader> reader, const size_t &batchSize, const size_t &shuffle = 0, const uint64_t &seed = 0)
+			: m_reader(std::move(reader))
+			, m_batchSize(batchSize)
+			, m_window(shuffle)
+			, m_rand(seed)
+		{
+			if (!m_reader)
+				throw Log("Dataset: DatasetStream: no reader.", Log::Severity::ERR0R);
+			if (m_batchSize == 0)
+				throw Log("Dataset: DatasetStream: batch size is 0.", Log::Severity::ERR0R);
+
+			m_slots[0].reserve(m_batchSize);
+			m_slots[1].reserve(m_batchSize);
+			m_thread = std::thread(&DatasetStream::_produce_, this);
+		}
+
+		DatasetStream(const DatasetStream &) = delete;
+		DatasetStream& operator=(const DatasetStream &) = delete;
+
+		~DatasetStream()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_changed.notify_all();
+			m_thread.join();
+		}
+
+		//Next batch, valid until the following call. nullptr once the epoch is done, call rewind for another.
+		//Errors of the reader are thrown here
+		const std::vector<NeuralNet::Data>* next()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			//The slot handed out last can be filled again
+			if (m_holding)
+			{
+				m_holding = false;
+				m_full[m_consume] = false;
+				m_consume ^= 1;
+				m_changed.notify_all();
+			}
+
+			m_changed.wait(lock, [this] { return m_full[m_consume] || m_ended || m_error; });
+			if (m_error)
+				std::rethrow_exception(std::exchange(m_error, nullptr));
+			if (!m_full[m_consume])
+				return nullptr;
+
+			m_holding = true;
+			return &m_slots[m_consume];
+		}
+
+		//Starts another epoch, batches of the current one not yet taken are dropped
+		void rewind()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_rewind = true;
+			m_changed.notify_all();
+			m_changed.wait(lock, [this] { return !m_rewind; });
+		}
+
+		size_t inputs() const { return m_reader->inputs(); }
+		size_t outputs() const { return m_reader->outputs(); }
+
+	private:
+		//Background thread, fills slots in turn until stopped
+		void _produce_()
+		{
+			size_t slot = 0;
+			std::vector<NeuralNet::Data> window;
+			//Samples of the window in use, the rest keep their vectors for reuse
+			size_t used = 0;
+			bool ended = false;
+
+			while (true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_changed.wait(lock, [&] { return m_stop || m_rewind || (!m_full[slot] && !ended); });
+					if (m_stop)
+						return;
+
+					if (m_rewind)
+					{
+						try { m_reader->rewind(); }
+						catch (...) { m_error = std::current_exception(); }
+
+						used = 0;
+						ended = m_ended = m_holding = false;
+						m_full[0] = m_full[1] = false;
+						slot = m_consume = 0;
+						m_rewind = false;
+						m_changed.notify_all();
+						continue;
+					}
+				}
+
+				//Filled without the lock, the consumer only touches the other slot
+				auto &batch = m_slots[slot];
+				batch.resize(m_batchSize);
+				size_t count = 0;
+
+				try
+				{
+					for (; count < m_batchSize; ++count)
+					{
+						//Top the window up, then hand out a random sample of it
+						while (used <= m_window)
+						{
+							if (window.size() == used)
+								window.emplace_back();
+							if (!m_reader->read(window[used]))
+								break;
+							++used;
+						}
+						if (used == 0)
+							break;
+
+						const auto pick = m_window == 0 ? 0 : std::uniform_int_distribution<size_t>(0, used - 1)(m_rand);
+						std::swap(batch[count], window[pick]);
+						std::swap(window[pick], window[--used]);
+					}
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_error = std::current_exception();
+					ended = m_ended = true;
+					m_changed.notify_all();
+					continue;
+				}
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_rewind)
+					continue;
+
+				batch.resize(count);
+
+				if (count != 0)
+				{
+					m_full[slot] = true;
+					slot ^= 1;
+				}
+				if (count < m_batchSize)
+					ended = m_ended = true;
+				m_changed.notify_all();
+			}
+		}
+
+		std::unique_ptr<DatasetReader> m_reader;
+		size_t m_batchSize;
+		size_t m_window;
+		std::mt19937_64 m_rand;
+
+		std::vector<NeuralNet::Data> m_slots[2];
+		bool m_full[2] = { false, false };
+		//Slot next() hands out, and whether the caller still holds it
+		size_t m_consume = 0;
+		bool m_holding = false;
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		bool m_stop = false;
+		bool m_rewind = false;
+		bool m_ended = false;
+		std::exception_ptr m_error;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,543 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Error.h"
+
+//Factorizations of dense matrices with solve, inverse and determinant.
+//Element (i, j) below is row i column j of the row major buffer, so matrix(j, i) in Matrix terms.
+//Panels of DECOMPOSITION_BLOCK columns are factored first, then the trailing matrix is
+//updated with a packed GEMM split over the pool, see Gemm.h
+
+namespace ctl
+{
+	//Columns per panel of the blocked factorizations
+	constexpr size_t DECOMPOSITION_BLOCK = 64;
+
+	//Calls func(begin, end) over [0, size) split over the pool when work is large enough
+	template<typename F>
+	void _parallelWork_(const size_t &size, const size_t &work, const Parallel &par, F &&func)
+	{
+		const auto threads = std::min(par.count(work), size);
+		if (threads <= 1)
+			func(size_t(0), size);
+		else
+			ThreadPool::global().parallelRange(size, threads, func);
+	}
+
+	//x = T^-1 x for an n x n triangular T, x is n rows of width columns xRow apart.
+	//Unit skips the diagonal. Earlier rows are taken off as axpys so rows of x are streamed,
+	//and the columns of x are split over the pool.
+	template<bool lower, bool unit, typename Type>
+	void _triangularSolve_(const Type *t, const size_t &tRow, const size_t &tCol, const size_t &n,
+		Type *x, const size_t &xRow, const size_t &width, const Parallel &par)
+	{
+		_parallelWork_(width, n * n * width / 2, par, [&](const size_t &begin, const size_t &end)
+		{
+			const auto count = end - begin;
+
+			for (size_t s = 0; s < n; ++s)
+			{
+				const auto i = lower ? s : n - 1 - s;
+				auto *xI = x + i * xRow + begin;
+
+				if constexpr (lower)
+					for (size_t j = 0; j < i; ++j)
+						Simd::axpy(Type(-t[i * tRow + j * tCol]), x + j * xRow + begin, xI, count);
+				else
+					for (size_t j = i + 1; j < n; ++j)
+						Simd::axpy(Type(-t[i * tRow + j * tCol]), x + j * xRow + begin, xI, count);
+
+				if constexpr (!unit)
+					Simd::scalar<Simd::Div>(xI, t[i * tRow + i * tCol], xI, count);
+			}
+		});
+	}
+
+	template<typename Type>
+	Matrix<Type> _identity_(const size_t &n)
+	{
+		Matrix<Type> id({ n, n }, 0);
+		for (size_t i = 0; i < n; ++i)
+			id(i, i) = Type(1);
+		return id;
+	}
+
+	//-------------------------------------------------------------------------------
+	//-----------------------------------LU------------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//PA = LU with partial pivoting, the unit diagonal of L is implied and both share one matrix
+	template<typename Type>
+	class LU
+	{
+		static_assert(std::is_floating_point_v<Type>, "LU: type must be floating point.");
+
+	public:
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		LU(const M &mat, const Parallel &par = Parallel::global())
+			: m_lu(mat)
+			, m_pivot(mat.dim()[0])
+			, m_par(par)
+		{
+			if (mat.dim()[0] != mat.dim()[1])
+				throw Log("LU: constructor: matrix is not square.", Log::Severity::ERR0R);
+
+			_factor_();
+		}
+
+		const auto& factors() const { return m_lu; }
+		//Row i of PA is row pivot()[i] of A
+		const auto& pivot() const { return m_pivot; }
+		bool singular() const { return m_singular; }
+
+		Type determinant() const
+		{
+			Type det = m_sign;
+			for (size_t i = 0; i < m_lu.dim()[0]; ++i)
+				det *= m_lu(i, i);
+			return det;
+		}
+
+		//x with A x = b, every column of b is a right hand side
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		Matrix<Type> solve(const M &b) const
+		{
+			const auto n = m_lu.dim()[0], width = b.dim()[0];
+
+			if (b.dim()[1] != n)
+				throw Log("LU: solve: height differs.", Log::Severity::ERR0R);
+			if (m_singular)
+				throw Log("LU: solve: matrix is singular.", Log::Severity::ERR0R);
+
+			Matrix<Type> x(b.dim(), 0);
+			if (x.dim().product() == 0)
+				return x;
+
+			for (size_t i = 0; i < n; ++i)
+				for (size_t j = 0; j < width; ++j)
+					x(j, i) = b(j, m_pivot[i]);
+
+			_triangularSolve_<true, true>(&m_lu.loc(0), n, size_t(1), n, &x.loc(0), width, width, m_par);
+			_triangularSolve_<false, false>(&m_lu.loc(0), n, size_t(1), n, &x.loc(0), width, width, m_par);
+
+			return x;
+		}
+
+		Matrix<Type> inverse() const { return solve(_identity_<Type>(m_lu.dim()[0])); }
+
+	private:
+		void _factor_()
+		{
+			const auto n = m_lu.dim()[0];
+			for (size_t i = 0; i < n; ++i)
+				m_pivot[i] = i;
+			if (n == 0)
+				return;
+
+			auto *a = &m_lu.loc(0);
+
+			for (size_t k0 = 0; k0 < n; k0 += DECOMPOSITION_BLOCK)
+			{
+				const auto kEnd = std::min(n, k0 + DECOMPOSITION_BLOCK);
+
+				//Panel, columns [k0, kEnd) of every row from k0, rows are swapped whole
+				for (size_t j = k0; j < kEnd; ++j)
+				{
+					size_t p = j;
+					for (size_t i = j + 1; i < n; ++i)
+						if (std::abs(a[i * n + j]) > std::abs(a[p * n + j]))
+							p = i;
+
+					if (p != j)
+					{
+						std::swap_ranges(a + j * n, a + (j + 1) * n, a + p * n);
+						std::swap(m_pivot[j], m_pivot[p]);
+						m_sign = -m_sign;
+					}
+
+					const auto diag = a[j * n + j];
+					if (diag == Type(0))
+					{
+						m_singular = true;
+						continue;
+					}
+
+					for (size_t i = j + 1; i < n; ++i)
+					{
+						auto *aI = a + i * n;
+						aI[j] /= diag;
+						Simd::axpy(Type(-aI[j]), a + j * n + j + 1, aI + j + 1, kEnd - j - 1);
+					}
+				}
+
+				if (kEnd == n)
+					break;
+
+				//U12 = L11^-1 A12
+				_triangularSolve_<true, true>(a + k0 * n + k0, n, size_t(1), kEnd - k0, a + k0 * n + kEnd, n, n - kEnd, m_par);
+
+				//A22 -= L21 U12
+				_gemmParallel_(n - kEnd, n - kEnd, kEnd - k0,
+					GemmOperand<Type>{ a + kEnd * n + k0, n, 1 },
+					GemmOperand<Type>{ a + k0 * n + kEnd, n, 1 },
+					a + kEnd * n + kEnd, n, m_par, Type(-1));
+			}
+		}
+
+		Matrix<Type> m_lu;
+		std::vector<size_t> m_pivot;
+		Parallel m_par;
+		Type m_sign = Type(1);
+		bool m_singular = false;
+	};
+
+	//-------------------------------------------------------------------------------
+	//--------------------------------Cholesky---------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//A = L L^T for a symmetric positive definite A, only the lower triangle of A is read
+	template<typename Type>
+	class Cholesky
+	{
+		static_assert(std::is_floating_point_v<Type>, "Cholesky: type must be floating point.");
+
+	public:
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		Cholesky(const M &mat, const Parallel &par = Parallel::global())
+			: m_l(mat)
+			, m_par(par)
+		{
+			if (mat.dim()[0] != mat.dim()[1])
+				throw Log("Cholesky: constructor: matrix is not square.", Log::Severity::ERR0R);
+
+			_factor_();
+		}
+
+		//L, zero above the diagonal
+		const auto& lower() const { return m_l; }
+
+		Type determinant() const
+		{
+			Type det = Type(1);
+			for (size_t i = 0; i < m_l.dim()[0]; ++i)
+				det *= m_l(i, i) * m_l(i, i);
+			return det;
+		}
+
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		Matrix<Type> solve(const M &b) const
+		{
+			const auto n = m_l.dim()[0], width = b.dim()[0];
+
+			if (b.dim()[1] != n)
+				throw Log("Cholesky: solve: height differs.", Log::Severity::ERR0R);
+
+			Matrix<Type> x(b);
+			if (x.dim().product() == 0)
+				return x;
+
+			//L y = b, then L^T x = y
+			_triangularSolve_<true, false>(&m_l.loc(0), n, size_t(1), n, &x.loc(0), width, width, m_par);
+			_triangularSolve_<false, false>(&m_l.loc(0), size_t(1), n, n, &x.loc(0), width, width, m_par);
+
+			return x;
+		}
+
+		Matrix<Type> inverse() const { return solve(_identity_<Type>(m_l.dim()[0])); }
+
+	private:
+		void _factor_()
+		{
+			const auto n = m_l.dim()[0];
+			if (n == 0)
+				return;
+
+			auto *a = &m_l.loc(0);
+
+			//a[i][j] - sum of a[i][p] * a[j][p] over the panel so far
+			auto reduce = [a, n](const size_t &i, const size_t &j, const size_t &k0)
+			{
+				auto x = a[i * n + j];
+				for (size_t p = k0; p < j; ++p)
+					x -= a[i * n + p] * a[j * n + p];
+				return x;
+			};
+
+			for (size_t k0 = 0; k0 < n; k0 += DECOMPOSITION_BLOCK)
+			{
+				const auto kEnd = std::min(n, k0 + DECOMPOSITION_BLOCK);
+
+				//Diagonal block
+				for (size_t j = k0; j < kEnd; ++j)
+				{
+					const auto d = reduce(j, j, k0);
+					if (!(d > Type(0)))
+						throw Log("Cholesky: constructor: matrix is not positive definite.", Log::Severity::ERR0R);
+
+					a[j * n + j] = std::sqrt(d);
+					for (size_t i = j + 1; i < kEnd; ++i)
+						a[i * n + j] = reduce(i, j, k0) / a[j * n + j];
+				}
+
+				if (kEnd == n)
+					break;
+
+				//L21 = A21 L11^-T, rows are independent
+				_parallelWork_(n - kEnd, (n - kEnd) * (kEnd - k0) * (kEnd - k0) / 2, m_par, [&](const size_t &begin, const size_t &end)
+				{
+					for (size_t i = kEnd + begin; i < kEnd + end; ++i)
+						for (size_t j = k0; j < kEnd; ++j)
+							a[i * n + j] = reduce(i, j, k0) / a[j * n + j];
+				});
+
+				//A22 -= L21 L21^T on the lower triangle, a block of rows at a time
+				const auto blocks = (n - kEnd + DECOMPOSITION_BLOCK - 1) / DECOMPOSITION_BLOCK;
+				auto update = [&](const size_t &b)
+				{
+					const auto r0 = kEnd + b * DECOMPOSITION_BLOCK;
+					const auto rows = std::min(DECOMPOSITION_BLOCK, n - r0);
+
+					_gemm_(rows, r0 + rows - kEnd, kEnd - k0,
+						GemmOperand<Type>{ a + r0 * n + k0, n, 1 },
+						GemmOperand<Type>{ a + kEnd * n + k0, 1, n },
+						a + r0 * n + kEnd, n, Type(-1));
+				};
+
+				if (m_par.count((n - kEnd) * (n - kEnd) * (kEnd - k0) / 2) == 1)
+					for (size_t b = 0; b < blocks; ++b)
+						update(b);
+				else
+					ThreadPool::global().parallelFor(blocks, update);
+			}
+
+			for (size_t i = 0; i < n; ++i)
+				std::fill(a + i * n + i + 1, a + (i + 1) * n, Type(0));
+		}
+
+		Matrix<Type> m_l;
+		Parallel m_par;
+	};
+
+	//-------------------------------------------------------------------------------
+	//-----------------------------------QR------------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//A = QR by Householder reflections for a matrix with at least as many rows as columns.
+	//R is the upper triangle, reflector j is I - tau[j] v v^T with v[j] = 1 and the rest of v below R.
+	//Panels are applied to the trailing matrix at once as I - V T V^T
+	template<typename Type>
+	class QR
+	{
+		static_assert(std::is_floating_point_v<Type>, "QR: type must be floating point.");
+
+	public:
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		QR(const M &mat, const Parallel &par = Parallel::global())
+			: m_qr(mat)
+			, m_tau(mat.dim()[0], 0)
+			, m_par(par)
+		{
+			if (mat.dim()[1] < mat.dim()[0])
+				throw Log("QR: constructor: fewer rows than columns.", Log::Severity::ERR0R);
+
+			_factor_();
+		}
+
+		const auto& factors() const { return m_qr; }
+		const auto& tau() const { return m_tau; }
+
+		//Square matrices only
+		Type determinant() const
+		{
+			if (m_qr.dim()[0] != m_qr.dim()[1])
+				throw Log("QR: determinant: matrix is not square.", Log::Severity::ERR0R);
+
+			//Every reflection flips the sign
+			Type det = Type(1);
+			for (size_t i = 0; i < m_qr.dim()[0]; ++i)
+				det *= m_tau[i] == Type(0) ? m_qr(i, i) : -m_qr(i, i);
+			return det;
+		}
+
+		//Least squares x minimizing |A x - b|, exact for square A
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		Matrix<Type> solve(const M &b) const
+		{
+			const auto n = m_qr.dim()[0], m = m_qr.dim()[1], width = b.dim()[0];
+
+			if (b.dim()[1] != m)
+				throw Log("QR: solve: height differs.", Log::Severity::ERR0R);
+			for (size_t i = 0; i < n; ++i)
+				if (m_qr(i, i) == Type(0))
+					throw Log("QR: solve: matrix is rank deficient.", Log::Severity::ERR0R);
+
+			Matrix<Type> y(b);
+			if (y.dim().product() == 0)
+				return Matrix<Type>({ width, n }, 0);
+
+			const auto *a = &m_qr.loc(0);
+			auto *x = &y.loc(0);
+
+			//y = Q^T b, one reflector at a time
+			_parallelWork_(width, m * n * width * 2, m_par, [&](const size_t &begin, const size_t &end)
+			{
+				const auto count = end - begin;
+				std::vector<Type> w(count);
+
+				for (size_t j = 0; j < n; ++j)
+				{
+					if (m_tau[j] == Type(0))
+						continue;
+
+					std::copy(x + j * width + begin, x + j * width + end, w.begin());
+					for (size_t i = j + 1; i < m; ++i)
+						Simd::axpy(a[i * n + j], x + i * width + begin, w.data(), count);
+
+					Simd::axpy(Type(-m_tau[j]), w.data(), x + j * width + begin, count);
+					for (size_t i = j + 1; i < m; ++i)
+						Simd::axpy(Type(-m_tau[j] * a[i * n + j]), w.data(), x + i * width + begin, count);
+				}
+			});
+
+			_triangularSolve_<false, false>(a, n, size_t(1), n, x, width, width, m_par);
+
+			Matrix<Type> result({ width, n }, 0);
+			std::copy(x, x + n * width, &result.loc(0));
+			return result;
+		}
+
+		Matrix<Type> inverse() const
+		{
+			if (m_qr.dim()[0] != m_qr.dim()[1])
+				throw Log("QR: inverse: matrix is not square.", Log::Severity::ERR0R);
+
+			return solve(_identity_<Type>(m_qr.dim()[0]));
+		}
+
+	private:
+		void _factor_()
+		{
+			const auto n = m_qr.dim()[0], m = m_qr.dim()[1];
+			if (n == 0)
+				return;
+
+			auto *a = &m_qr.loc(0);
+			std::vector<Type> w(DECOMPOSITION_BLOCK), v, t, wy;
+
+			for (size_t k0 = 0; k0 < n; k0 += DECOMPOSITION_BLOCK)
+			{
+				const auto kEnd = std::min(n, k0 + DECOMPOSITION_BLOCK), nb = kEnd - k0;
+
+				//Panel, each reflector is applied to the rest of the panel right away
+				for (size_t j = k0; j < kEnd; ++j)
+				{
+					_householder_(a, m, n, j);
+
+					const auto width = kEnd - j - 1;
+					if (m_tau[j] == Type(0) || width == 0)
+						continue;
+
+					std::copy(a + j * n + j + 1, a + j * n + kEnd, w.begin());
+					for (size_t i = j + 1; i < m; ++i)
+						Simd::axpy(a[i * n + j], a + i * n + j + 1, w.data(), width);
+
+					Simd::axpy(Type(-m_tau[j]), w.data(), a + j * n + j + 1, width);
+					for (size_t i = j + 1; i < m; ++i)
+						Simd::axpy(Type(-m_tau[j] * a[i * n + j]), w.data(), a + i * n + j + 1, width);
+				}
+
+				if (kEnd == n)
+					break;
+
+				const auto rows = m - k0, cols = n - kEnd;
+
+				//V with its unit diagonal and zeros above
+				v.assign(rows * nb, Type(0));
+				for (size_t i = 0; i < rows; ++i)
+					for (size_t j = 0; j < std::min(i + 1, nb); ++j)
+						v[i * nb + j] = i == j ? Type(1) : a[(k0 + i) * n + k0 + j];
+
+				//Upper triangular T with H(k0) ... H(kEnd - 1) = I - V T V^T
+				t.assign(nb * nb, Type(0));
+				for (size_t i = 0; i < nb; ++i)
+				{
+					const auto tau = m_tau[k0 + i];
+					t[i * nb + i] = tau;
+
+					//z = -tau V[:, 0..i]^T v_i, then T[0..i, i] = T[0..i, 0..i] z
+					for (size_t j = 0; j < i; ++j)
+					{
+						Type z = 0;
+						for (size_t r = i; r < rows; ++r)
+							z += v[r * nb + j] * v[r * nb + i];
+						w[j] = -tau * z;
+					}
+					for (size_t j = 0; j < i; ++j)
+					{
+						Type sum = 0;
+						for (size_t l = j; l < i; ++l)
+							sum += t[j * nb + l] * w[l];
+						t[j * nb + i] = sum;
+					}
+				}
+
+				//A2 -= V T^T V^T A2
+				wy.assign(nb * cols, Type(0));
+				_gemmParallel_(nb, cols, rows,
+					GemmOperand<Type>{ v.data(), 1, nb },
+					GemmOperand<Type>{ a + k0 * n + kEnd, n, 1 },
+					wy.data(), cols, m_par);
+
+				for (size_t s = 0; s < nb; ++s)
+				{
+					const auto i = nb - 1 - s;
+					Simd::scalar<Simd::Mul>(wy.data() + i * cols, t[i * nb + i], wy.data() + i * cols, cols);
+					for (size_t j = 0; j < i; ++j)
+						Simd::axpy(t[j * nb + i], wy.data() + j * cols, wy.data() + i * cols, cols);
+				}
+
+				_gemmParallel_(rows, cols, nb,
+					GemmOperand<Type>{ v.data(), nb, 1 },
+					GemmOperand<Type>{ wy.data(), cols, 1 },
+					a + k0 * n + kEnd, n, m_par, Type(-1));
+			}
+		}
+
+		//Reflector zeroing column j below the diagonal, leaves beta on the diagonal and v below it
+		void _householder_(Type *a, const size_t &m, const size_t &n, const size_t &j)
+		{
+			const auto alpha = a[j * n + j];
+
+			Type sigma = 0;
+			for (size_t i = j + 1; i < m; ++i)
+				sigma += a[i * n + j] * a[i * n + j];
+
+			if (sigma == Type(0))
+			{
+				m_tau[j] = 0;
+				return;
+			}
+
+			const auto norm = std::sqrt(alpha * alpha + sigma);
+			const auto beta = alpha >= Type(0) ? -norm : norm;
+			const auto scale = Type(1) / (alpha - beta);
+
+			m_tau[j] = (beta - alpha) / beta;
+			for (size_t i = j + 1; i < m; ++i)
+				a[i * n + j] *= scale;
+			a[j * n + j] = beta;
+		}
+
+		Matrix<Type> m_qr;
+		std::vector<Type> m_tau;
+		Parallel m_par;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <array>
+#include <utility>
+#include <type_traits>
+
+#include "Matrix.h"
+#include "Vector.h"
+#include "Error.h"
+
+namespace ctl
+{
+	//Matrix with its size in the type, stored inline so it never allocates.
+	//Element (x, y) is column x of row y like Matrix, the products and inverses unroll fully
+	template<typename Type, size_t Rows, size_t Cols>
+	class FixedMatrix
+	{
+		static_assert(std::is_arithmetic_v<Type>, "FixedMatrix: type must be arithmetic.");
+
+	public:
+		using value_type = Type;
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		//Zeroed
+		constexpr FixedMatrix() : m_data{} {}
+
+		//Row major elements
+		template<typename... S, typename = typename std::enable_if_t<sizeof...(S) == Rows * Cols && std::conjunction_v<std::is_arithmetic<S>...>>>
+		constexpr FixedMatrix(const S&... ts) : m_data{ static_cast<Type>(ts)... } {}
+
+		constexpr FixedMatrix(const FixedMatrix &) = default;
+		constexpr FixedMatrix& operator=(const FixedMatrix &) = default;
+
+		template<typename Allocator>
+		explicit FixedMatrix(const Matrix<Type, Allocator> &mat)
+			: m_data{}
+		{
+			if (mat.dim() != dim())
+				throw Log("FixedMatrix: constructor: size differs.", Log::Severity::ERR0R);
+
+			for (size_t i = 0; i < Rows * Cols; ++i)
+				m_data[i] = mat.loc(i);
+		}
+
+		static constexpr FixedMatrix filled(const Type &x)
+		{
+			FixedMatrix mat;
+			for (auto &i : mat.m_data)
+				i = x;
+			return mat;
+		}
+
+		static constexpr FixedMatrix identity()
+		{
+			static_assert(Rows == Cols, "FixedMatrix: identity: not square.");
+
+			FixedMatrix mat;
+			for (size_t i = 0; i < Rows; ++i)
+				mat(i, i) = Type(1);
+			return mat;
+		}
+
+		//---------------------------------------------------------
+		//----------------------Operators--------------------------
+		//---------------------------------------------------------
+
+		constexpr auto& operator()(const size_t &x, const size_t &y) { return m_data[x + Cols * y]; }
+		constexpr const auto& operator()(const size_t &x, const size_t &y) const { return m_data[x + Cols * y]; }
+
+		constexpr auto& loc(const size_t &xy) { return m_data[xy]; }
+		constexpr const auto& loc(const size_t &xy) const { return m_data[xy]; }
+
+		constexpr auto& data() { return m_data; }
+		constexpr const auto& data() const { return m_data; }
+
+		//{ width, height } like Matrix
+		static constexpr NumVec<size_t, 2> dim() { return { Cols, Rows }; }
+
+		constexpr auto& operator+=(const FixedMatrix &m) { return _apply_(m, std::make_index_sequence<Rows * Cols>(), [](Type &a, const Type &b) { a += b; }); }
+		constexpr auto& operator-=(const FixedMatrix &m) { return _apply_(m, std::make_index_sequence<Rows * Cols>(), [](Type &a, const Type &b) { a -= b; }); }
+		constexpr auto& operator*=(const Type &x) { return _apply_(filled(x), std::make_index_sequence<Rows * Cols>(), [](Type &a, const Type &b) { a *= b; }); }
+		constexpr auto& operator/=(const Type &x) { return _apply_(filled(x), std::make_index_sequence<Rows * Cols>(), [](Type &a, const Type &b) { a /= b; }); }
+
+		constexpr auto operator+(const FixedMatrix &m) const { auto mat = *this; return mat += m; }
+		constexpr auto operator-(const FixedMatrix &m) const { auto mat = *this; return mat -= m; }
+		constexpr auto operator*(const Type &x) const { auto mat = *this; return mat *= x; }
+		constexpr auto operator/(const Type &x) const { auto mat = *this; return mat /= x; }
+
+		constexpr bool operator==(const FixedMatrix &m) const
+		{
+			for (size_t i = 0; i < Rows * Cols; ++i)
+				if (m_data[i] != m.m_data[i])
+					return false;
+			return true;
+		}
+		constexpr bool operator!=(const FixedMatrix &m) const { return !(*this == m); }
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//Rows x Cols times Cols x N, every element sums its products in order
+		template<size_t N>
+		constexpr auto dotProduct(const FixedMatrix<Type, Cols, N> &mat2) const
+		{
+			return _dotProduct_(mat2, std::make_index_sequence<Rows * N>());
+		}
+
+		//Times a column vector
+		constexpr auto dotProduct(const NumVec<Type, Cols> &v) const
+		{
+			return _dotProduct_(v, std::make_index_sequence<Rows>());
+		}
+
+		constexpr auto transpose() const
+		{
+			return _transpose_(std::make_index_sequence<Rows * Cols>());
+		}
+
+		constexpr auto row(const size_t &y) const
+		{
+			NumVec<Type, Cols> v;
+			for (size_t x = 0; x < Cols; ++x)
+				v.data()[x] = (*this)(x, y);
+			return v;
+		}
+
+		constexpr auto col(const size_t &x) const
+		{
+			NumVec<Type, Rows> v;
+			for (size_t y = 0; y < Rows; ++y)
+				v.data()[y] = (*this)(x, y);
+			return v;
+		}
+
+		constexpr Type determinant() const
+		{
+			static_assert(Rows == Cols && Rows <= 4, "FixedMatrix: determinant: only square up to 4x4.");
+
+			const auto &a = *this;
+			if constexpr (Rows == 1)
+				return a(0, 0);
+			else if constexpr (Rows == 2)
+				return a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+			else if constexpr (Rows == 3)
+				return a(0, 0) * (a(1, 1) * a(2, 2) - a(2, 1) * a(1, 2))
+					- a(1, 0) * (a(0, 1) * a(2, 2) - a(2, 1) * a(0, 2))
+					+ a(2, 0) * (a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2));
+			else
+			{
+				const auto m = _minors4_();
+				return m[0] * m[11] - m[1] * m[10] + m[2] * m[9] + m[3] * m[8] - m[4] * m[7] + m[5] * m[6];
+			}
+		}
+
+		//Closed form through the adjugate, throws when singular
+		constexpr FixedMatrix inverse() const
+		{
+			static_assert(Rows == Cols && Rows <= 4, "FixedMatrix: inverse: only square up to 4x4.");
+			static_assert(std::is_floating_point_v<Type>, "FixedMatrix: inverse: type must be floating point.");
+
+			const auto det = determinant();
+			if (det == Type(0))
+				throw Log("FixedMatrix: inverse: singular matrix.", Log::Severity::ERR0R);
+
+			const auto inv = Type(1) / det;
+			const auto &a = *this;
+
+			if constexpr (Rows == 1)
+				return FixedMatrix(inv);
+			else if constexpr (Rows == 2)
+				return FixedMatrix(
+					a(1, 1) * inv, -a(1, 0) * inv,
+					-a(0, 1) * inv, a(0, 0) * inv);
+			else if constexpr (Rows == 3)
+				return FixedMatrix(
+					(a(1, 1) * a(2, 2) - a(2, 1) * a(1, 2)) * inv,
+					(a(2, 0) * a(1, 2) - a(1, 0) * a(2, 2)) * inv,
+					(a(1, 0) * a(2, 1) - a(2, 0) * a(1, 1)) * inv,
+					(a(2, 1) * a(0, 2) - a(0, 1) * a(2, 2)) * inv,
+					(a(0, 0) * a(2, 2) - a(2, 0) * a(0, 2)) * inv,
+					(a(2, 0) * a(0, 1) - a(0, 0) * a(2, 1)) * inv,
+					(a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2)) * inv,
+					(a(1, 0) * a(0, 2) - a(0, 0) * a(1, 2)) * inv,
+					(a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1)) * inv);
+			else
+			{
+				//2x2 minors of the top rows (s) and bottom rows (c)
+				const auto m = _minors4_();
+				const auto &s0 = m[0], &s1 = m[1], &s2 = m[2], &s3 = m[3], &s4 = m[4], &s5 = m[5];
+				const auto &c0 = m[6], &c1 = m[7], &c2 = m[8], &c3 = m[9], &c4 = m[10], &c5 = m[11];
+
+				return FixedMatrix(
+					(a(1, 1) * c5 - a(2, 1) * c4 + a(3, 1) * c3) * inv,
+					(-a(1, 0) * c5 + a(2, 0) * c4 - a(3, 0) * c3) * inv,
+					(a(1, 3) * s5 - a(2, 3) * s4 + a(3, 3) * s3) * inv,
+					(-a(1, 2) * s5 + a(2, 2) * s4 - a(3, 2) * s3) * inv,
+
+					(-a(0, 1) * c5 + a(2, 1) * c2 - a(3, 1) * c1) * inv,
+					(a(0, 0) * c5 - a(2, 0) * c2 + a(3, 0) * c1) * inv,
+					(-a(0, 3) * s5 + a(2, 3) * s2 - a(3, 3) * s1) * inv,
+					(a(0, 2) * s5 - a(2, 2) * s2 + a(3, 2) * s1) * inv,
+
+					(a(0, 1) * c4 - a(1, 1) * c2 + a(3, 1) * c0) * inv,
+					(-a(0, 0) * c4 + a(1, 0) * c2 - a(3, 0) * c0) * inv,
+					(a(0, 3) * s4 - a(1, 3) * s2 + a(3, 3) * s0) * inv,
+					(-a(0, 2) * s4 + a(1, 2) * s2 - a(3, 2) * s0) * inv,
+
+					(-a(0, 1) * c3 + a(1, 1) * c1 - a(2, 1) * c0) * inv,
+					(a(0, 0) * c3 - a(1, 0) * c1 + a(2, 0) * c0) * inv,
+					(-a(0, 3) * s3 + a(1, 3) * s1 - a(2, 3) * s0) * inv,
+					(a(0, 2) * s3 - a(1, 2) * s1 + a(2, 2) * s0) * inv);
+			}
+		}
+
+		//Shares the inline storage, so it can take part in Matrix operations
+		auto view() { return MatrixView<Type>(m_data.data(), dim(), { 1, Cols }); }
+		auto view() const { return MatrixView<const Type>(m_data.data(), dim(), { 1, Cols }); }
+
+		auto toMatrix() const
+		{
+			Matrix<Type> mat(dim(), Type(0));
+			for (size_t i = 0; i < Rows * Cols; ++i)
+				mat.loc(i) = m_data[i];
+			return mat;
+		}
+
+	private:
+		template<typename F, size_t... I>
+		constexpr FixedMatrix& _apply_(const FixedMatrix &m, std::index_sequence<I...>, F &&func)
+		{
+			(func(m_data[I], m.m_data[I]), ...);
+			return *this;
+		}
+
+		template<size_t... K, typename B>
+		constexpr Type _dotAt_(const size_t &y, const B &b, std::index_sequence<K...>) const
+		{
+			return (... + ((*this)(K, y) * b(K)));
+		}
+
+		template<size_t N, size_t... I>
+		constexpr auto _dotProduct_(const FixedMatrix<Type, Cols, N> &mat2, std::index_sequence<I...>) const
+		{
+			return FixedMatrix<Type, Rows, N>(_dotAt_(I / N, [&mat2](const size_t &k) { return mat2(I % N, k); }, std::make_index_sequence<Cols>())...);
+		}
+
+		template<size_t... I>
+		constexpr auto _dotProduct_(const NumVec<Type, Cols> &v, std::index_sequence<I...>) const
+		{
+			return NumVec<Type, Rows>(_dotAt_(I, [&v](const size_t &k) { return v.data()[k]; }, std::make_index_sequence<Cols>())...);
+		}
+
+		template<size_t... I>
+		constexpr auto _transpose_(std::index_sequence<I...>) const
+		{
+			return FixedMatrix<Type, Cols, Rows>((*this)(I / Rows, I % Rows)...);
+		}
+
+		//s0..s5 from rows 0 and 1, c0..c5 from rows 2 and 3
+		constexpr std::array<Type, 12> _minors4_() const
+		{
+			const auto &a = *this;
+			return {
+				a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0),
+				a(0, 0) * a(2, 1) - a(0, 1) * a(2, 0),
+				a(0, 0) * a(3, 1) - a(0, 1) * a(3, 0),
+				a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0),
+				a(1, 0) * a(3, 1) - a(1, 1) * a(3, 0),
+				a(2, 0) * a(3, 1) - a(2, 1) * a(3, 0),
+				a(0, 2) * a(1, 3) - a(0, 3) * a(1, 2),
+				a(0, 2) * a(2, 3) - a(0, 3) * a(2, 2),
+				a(0, 2) * a(3, 3) - a(0, 3) * a(3, 2),
+				a(1, 2) * a(2, 3) - a(1, 3) * a(2, 2),
+				a(1, 2) * a(3, 3) - a(1, 3) * a(3, 2),
+				a(2, 2) * a(3, 3) - a(2, 3) * a(3, 2)
+			};
+		}
+
+		std::array<Type, Rows * Cols> m_data;
+	};
+
+	template<typename Type, size_t Rows, size_t Cols>
+	constexpr auto operator*(const Type &x, const FixedMatrix<Type, Rows, Cols> &m) { return m * x; }
+}
\ No newline at end of file
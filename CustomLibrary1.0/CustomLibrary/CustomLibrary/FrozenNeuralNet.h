@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+
+#include "NeuralNet.h"
+#include "NeuralNetFile.h"
+#include "Allocator.h"
+#include "Activation.h"
+#include "Simd.h"
+#include "Error.h"
+
+//Inference only copy of a trained network. Weights are packed once into one aligned block and
+//activations ping-pong between two buffers sized to the widest layer, so a query doesn't allocate.
+
+namespace ctl
+{
+	class FrozenNeuralNet
+	{
+	public:
+		using Storage = std::vector<double, AlignedAllocator<double>>;
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		FrozenNeuralNet() = default;
+		//Copies share the weights and get their own buffers, make one per serving thread
+		FrozenNeuralNet(const FrozenNeuralNet &) = default;
+		FrozenNeuralNet(FrozenNeuralNet &&) = default;
+
+		//From a NeuralNet or a MappedNeuralNet
+		template<typename Net, typename = typename std::enable_if_t<std::is_same_v<Net, NeuralNet> || std::is_same_v<Net, MappedNeuralNet>>>
+		explicit FrozenNeuralNet(const Net &net)
+			: m_neurons(net.neurons())
+			, m_activations(net.activations())
+		{
+			if (m_neurons.size() < 2)
+				throw Log("FrozenNeuralNet: constructor: network has no connections.", Log::Severity::ERR0R);
+			if (!_matchesNeurons_(m_neurons, net.connections()))
+				throw Log("FrozenNeuralNet: constructor: connections are inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			//Every matrix starts on a cache line
+			const auto align = [](const size_t &n) { return (n + CACHE_LINE / sizeof(double) - 1) / (CACHE_LINE / sizeof(double)) * (CACHE_LINE / sizeof(double)); };
+
+			size_t size = 0;
+			for (size_t i = 0; i + 1 < m_neurons.size(); ++i)
+			{
+				m_offsets.push_back({ size, size + align(m_neurons[i] * m_neurons[i + 1]) });
+				size = m_offsets.back()[1] + align(m_neurons[i + 1]);
+			}
+
+			auto weights = std::make_shared<Storage>(size, 0.);
+			for (size_t i = 0; i < m_offsets.size(); ++i)
+			{
+				const auto &conn = net.connections()[i];
+				for (size_t y = 0; y < m_neurons[i + 1]; ++y)
+				{
+					for (size_t x = 0; x < m_neurons[i]; ++x)
+						(*weights)[m_offsets[i][0] + x + y * m_neurons[i]] = conn[0](x, y);
+					(*weights)[m_offsets[i][1] + y] = conn[1](0, y);
+				}
+			}
+			m_weights = std::move(weights);
+
+			const auto widest = *std::max_element(m_neurons.begin(), m_neurons.end());
+			m_buffers[0].resize(widest);
+			m_buffers[1].resize(widest);
+		}
+
+		//---------------------------------------------------------
+		//----------------------Operators--------------------------
+		//---------------------------------------------------------
+
+		FrozenNeuralNet& operator=(const FrozenNeuralNet &) = default;
+		FrozenNeuralNet& operator=(FrozenNeuralNet &&) = default;
+
+		const auto& neurons() const { return m_neurons; }
+		size_t inputs() const { return m_neurons.empty() ? 0 : m_neurons.front(); }
+		size_t outputs() const { return m_neurons.empty() ? 0 : m_neurons.back(); }
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//Feeds inputs() values forward, returns outputs() values that stay valid until the next query.
+		//Each layer starts from its bias, adds weights x previous into it and applies its activation in place
+		const double* query(const double *input)
+		{
+			const double *from = input;
+			for (size_t i = 0; i < m_offsets.size(); ++i)
+			{
+				const auto k = m_neurons[i], m = m_neurons[i + 1];
+				const auto *weight = m_weights->data() + m_offsets[i][0], *bias = m_weights->data() + m_offsets[i][1];
+				auto *to = m_buffers[i % 2].data();
+
+				std::copy(bias, bias + m, to);
+				Simd::dotRows(weight, k, m, from, k, to, 1);
+				activate(m_activations[i], to, 1, m);
+
+				from = to;
+			}
+
+			return from;
+		}
+
+		const double* query(const std::vector<double> &input)
+		{
+			if (input.size() != inputs())
+				throw Log("FrozenNeuralNet: query: Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			return query(input.data());
+		}
+
+		//Writes outputs() values to output
+		void query(const double *input, double *output)
+		{
+			const auto *result = query(input);
+			std::copy(result, result + outputs(), output);
+		}
+
+	private:
+		std::vector<size_t> m_neurons;
+		std::vector<Activation> m_activations;
+		//Weight and bias offsets of each connection into m_weights
+		std::vector<NumVec<size_t, 2>> m_offsets;
+		std::shared_ptr<const Storage> m_weights;
+		std::array<Storage, 2> m_buffers;
+	};
+}
\ No newline at end of file
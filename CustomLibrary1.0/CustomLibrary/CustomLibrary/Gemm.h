@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "Simd.h"
+
+namespace ctl
+{
+	//Tiling of the packed multiply
+	//MR x NR is the register tile, a KC x NR sliver of B is sized for L1,
+	//an MC x KC panel of A for L2 and a KC x NC panel of B for L3
+	template<typename Type>
+	struct GemmBlock
+	{
+		static constexpr size_t MR = 4;
+		static constexpr size_t NR = std::clamp<size_t>(32 / sizeof(Type), 4, 16);
+		static constexpr size_t KC = std::clamp<size_t>(2048 / sizeof(Type), 128, 512);
+		static constexpr size_t MC = std::clamp<size_t>(65536 / (KC * sizeof(Type)) * MR, MR, 256);
+		static constexpr size_t NC = 4096;
+	};
+
+	//Strided read only operand, element (i, j) lives at ptr[i * row + j * col]
+	template<typename Type>
+	struct GemmOperand
+	{
+		const Type *ptr;
+		size_t row;
+		size_t col;
+
+		constexpr const Type& operator()(const size_t &i, const size_t &j) const { return ptr[i * row + j * col]; }
+	};
+
+	//Pack an mc x kc block of alpha * A into MR row micro panels, rows past mc are zero
+	template<typename Type>
+	void _gemmPackA_(const GemmOperand<Type> &a, const size_t &mc, const size_t &kc, Type *to, const Type &alpha)
+	{
+		constexpr auto MR = GemmBlock<Type>::MR;
+
+		for (size_t i = 0; i < mc; i += MR)
+		{
+			const auto rows = std::min(MR, mc - i);
+
+			for (size_t p = 0; p < kc; ++p)
+			{
+				size_t r = 0;
+				for (; r < rows; ++r)
+					*to++ = alpha * a(i + r, p);
+				for (; r < MR; ++r)
+					*to++ = Type(0);
+			}
+		}
+	}
+
+	//Pack a kc x nc block of B into NR column micro panels, columns past nc are zero
+	template<typename Type>
+	void _gemmPackB_(const GemmOperand<Type> &b, const size_t &kc, const size_t &nc, Type *to)
+	{
+		constexpr auto NR = GemmBlock<Type>::NR;
+
+		for (size_t j = 0; j < nc; j += NR)
+		{
+			const auto cols = std::min(NR, nc - j);
+
+			for (size_t p = 0; p < kc; ++p)
+			{
+				const auto *from = &b(p, j);
+
+				size_t c = 0;
+				if (b.col == 1)
+					for (; c < cols; ++c)
+						*to++ = from[c];
+				else
+					for (; c < cols; ++c)
+						*to++ = from[c * b.col];
+				for (; c < NR; ++c)
+					*to++ = Type(0);
+			}
+		}
+	}
+
+	//MR x NR register tile: C += A * B over kc
+	//The tile starts from C so every element sums its products in the same order as a naive loop
+	template<typename Type>
+	void _gemmMicro_(const size_t &kc, const Type *ap, const Type *bp, Type *c, const size_t &cRow, const size_t &mr, const size_t &nr)
+	{
+		constexpr auto MR = GemmBlock<Type>::MR;
+		constexpr auto NR = GemmBlock<Type>::NR;
+
+		Type acc[MR][NR] = {};
+		for (size_t i = 0; i < mr; ++i)
+			for (size_t j = 0; j < nr; ++j)
+				acc[i][j] = c[i * cRow + j];
+
+		for (size_t p = 0; p < kc; ++p, ap += MR, bp += NR)
+			for (size_t i = 0; i < MR; ++i)
+			{
+				const auto x = ap[i];
+				for (size_t j = 0; j < NR; ++j)
+					acc[i][j] += x * bp[j];
+			}
+
+		for (size_t i = 0; i < mr; ++i)
+			for (size_t j = 0; j < nr; ++j)
+				c[i * cRow + j] = acc[i][j];
+	}
+
+	//Unpacked row by row multiply for operands too small to amortize packing
+	template<typename Type>
+	void _gemmSmall_(const size_t &m, const size_t &n, const size_t &k,
+		const GemmOperand<Type> &a, const GemmOperand<Type> &b, Type *c, const size_t &cRow, const Type &alpha)
+	{
+		for (size_t i = 0; i < m; ++i)
+		{
+			auto *cI = c + i * cRow;
+			for (size_t p = 0; p < k; ++p)
+			{
+				const auto x = alpha * a(i, p);
+				const auto *bP = &b(p, 0);
+				if (b.col == 1)
+					for (size_t j = 0; j < n; ++j)
+						cI[j] += x * bP[j];
+				else
+					for (size_t j = 0; j < n; ++j)
+						cI[j] += x * bP[j * b.col];
+			}
+		}
+	}
+
+	//Matrix times column vector, each element of A is read once.
+	//Rows of A are dotted with b, a transposed A is instead added column by column into C
+	//in blocks that stay in L1, which keeps the serial order of the sums
+	template<typename Type>
+	void _gemv_(const size_t &m, const size_t &k,
+		const GemmOperand<Type> &a, const GemmOperand<Type> &b, Type *c, const size_t &cRow, const Type &alpha)
+	{
+		constexpr size_t BLOCK = 8192 / sizeof(Type);
+
+		//alpha goes into the packed vector
+		const Type *x = b.ptr;
+		if (b.row != 1 || alpha != Type(1))
+		{
+			thread_local std::vector<Type> packB;
+			packB.resize(k);
+			for (size_t p = 0; p < k; ++p)
+				packB[p] = alpha * b(p, 0);
+			x = packB.data();
+		}
+
+		if (a.col == 1)
+			return Simd::dotRows(a.ptr, a.row, m, x, k, c, cRow);
+
+		if (cRow != 1)
+			return _gemmSmall_(m, size_t(1), k, a, GemmOperand<Type>{ x, 1, 0 }, c, cRow, Type(1));
+
+		for (size_t i = 0; i < m; i += BLOCK)
+		{
+			const auto rows = std::min(BLOCK, m - i);
+			for (size_t p = 0; p < k; ++p)
+				Simd::axpy(x[p], &a(i, p), c + i, rows);
+		}
+	}
+
+	//C(m x n) += alpha * A(m x k) * B(k x n), C is row major with row stride cRow
+	template<typename Type>
+	void _gemm_(const size_t &m, const size_t &n, const size_t &k,
+		const GemmOperand<Type> &a, const GemmOperand<Type> &b, Type *c, const size_t &cRow, const Type &alpha = Type(1))
+	{
+		using Block = GemmBlock<Type>;
+
+		if (n == 1 && (a.col == 1 || a.row == 1))
+			return _gemv_(m, k, a, b, c, cRow, alpha);
+
+		if (m * n * k <= 32 * 32 * 32 || m < Block::MR || n < Block::NR)
+			return _gemmSmall_(m, n, k, a, b, c, cRow, alpha);
+
+		//Reused between calls, packing must not allocate in steady state
+		thread_local std::vector<Type> packA, packB;
+		packA.resize(Block::MC * Block::KC);
+		packB.resize(Block::KC * ((std::min(Block::NC, n) + Block::NR - 1) / Block::NR * Block::NR));
+
+		for (size_t jc = 0; jc < n; jc += Block::NC)
+		{
+			const auto nc = std::min(Block::NC, n - jc);
+
+			for (size_t pc = 0; pc < k; pc += Block::KC)
+			{
+				const auto kc = std::min(Block::KC, k - pc);
+				_gemmPackB_(GemmOperand<Type>{ &b(pc, jc), b.row, b.col }, kc, nc, packB.data());
+
+				for (size_t ic = 0; ic < m; ic += Block::MC)
+				{
+					const auto mc = std::min(Block::MC, m - ic);
+					_gemmPackA_(GemmOperand<Type>{ &a(ic, pc), a.row, a.col }, mc, kc, packA.data(), alpha);
+
+					for (size_t jr = 0; jr < nc; jr += Block::NR)
+						for (size_t ir = 0; ir < mc; ir += Block::MR)
+							_gemmMicro_(kc, packA.data() + ir * kc, packB.data() + jr * kc,
+								c + (ic + ir) * cRow + jc + jr, cRow,
+								std::min(Block::MR, mc - ir), std::min(Block::NR, nc - jr));
+				}
+			}
+		}
+	}
+
+	//_gemm_ split over blocks of output rows, each thread packs its own panels
+	template<typename Type>
+	void _gemmParallel_(const size_t &m, const size_t &n, const size_t &k,
+		const GemmOperand<Type> &a, const GemmOperand<Type> &b, Type *c, const size_t &cRow, const Parallel &par, const Type &alpha = Type(1))
+	{
+		constexpr auto MR = GemmBlock<Type>::MR;
+
+		const auto threads = par.count(m * n * k);
+		if (threads == 1)
+			return _gemm_(m, n, k, a, b, c, cRow, alpha);
+
+		ThreadPool::global().parallelRange((m + MR - 1) / MR, threads, [&](const size_t &begin, const size_t &end)
+		{
+			const auto rowBegin = begin * MR, rowEnd = std::min(m, end * MR);
+			_gemm_(rowEnd - rowBegin, n, k, GemmOperand<Type>{ &a(rowBegin, 0), a.row, a.col }, b, c + rowBegin * cRow, cRow, alpha);
+		});
+	}
+}
\ No newline at end of file
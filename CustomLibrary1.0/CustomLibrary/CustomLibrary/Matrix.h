@@ -2,18 +2,159 @@
 
 #include <vector>
 #include <functional>
+#include <utility>
 
 #include "Error.h"
 #include "Vector.h"
 #include "RandomGenerator.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Allocator.h"
 
 namespace ctl
 {
+	//-------------------------------------------------------------------------------
+	//---------------------------Expression Traits-----------------------------------
+	//-------------------------------------------------------------------------------
+
+	//Base of the lazily evaluated expressions built by the Matrix operators
+	struct _MatrixExprTag_ {};
+
+	template<typename T>
+	constexpr bool _is_matrix_expr_ = std::is_base_of_v<_MatrixExprTag_, std::decay_t<T>>;
+
+	template<typename T, typename = void>
+	constexpr bool _is_matrix_ = false;
+	template<typename T>
+	constexpr bool _is_matrix_<T, std::void_t<typename std::decay_t<T>::matrix_type>> = 
+		std::is_same_v<std::decay_t<T>, typename std::decay_t<T>::matrix_type>;
+
+	template<typename Type>
+	class MatrixView;
+
+	template<typename T>
+	struct _MatrixViewTrait_ : std::false_type {};
+	template<typename Type>
+	struct _MatrixViewTrait_<MatrixView<Type>> : std::true_type {};
+
+	template<typename T>
+	constexpr bool _is_matrix_view_ = _MatrixViewTrait_<std::decay_t<T>>::value;
+
+	//Matrix, view or expression
+	template<typename T>
+	constexpr bool _is_matrix_operand_ = _is_matrix_<T> || _is_matrix_expr_<T> || _is_matrix_view_<T>;
+
+	//Reads through a view, so it may overlap whatever it is written to
+	template<typename T, typename = void>
+	constexpr bool _is_viewed_ = _is_matrix_view_<T>;
+	template<typename T>
+	constexpr bool _is_viewed_<T, std::enable_if_t<_is_matrix_expr_<T>>> = std::decay_t<T>::viewed;
+
+	//Can be read linearly through loc
+	template<typename M>
+	bool _contiguousOf_(const M &m)
+	{
+		if constexpr (_is_matrix_<M>)
+			return true;
+		else
+			return m.contiguous();
+	}
+
+	//Reads any element in [begin, end)
+	template<typename M, typename Type>
+	bool _overlapsOf_(const M &m, const Type *begin, const Type *end)
+	{
+		if constexpr (_is_matrix_<M>)
+			return m.data().data() < end && begin < m.data().data() + m.data().size();
+		else
+			return m._overlaps_(begin, end);
+	}
+
+	//Strided operand for the multiply in Gemm.h, no copy is made of views
+	template<typename M>
+	GemmOperand<typename std::decay_t<M>::value_type> _gemmOperandOf_(const M &m)
+	{
+		if constexpr (_is_matrix_<M>)
+			return { m.data().data(), m.dim()[0], 1 };
+		else
+			return { m.ptr() + m.offset(), m.stride()[1], m.stride()[0] };
+	}
+
+	template<typename Result, typename M1, typename M2>
+	Result _dotProduct_(const M1 &mat1, const M2 &mat2, const Parallel &par);
+
+	template<typename E, typename F>
+	class _MatrixApply_;
+
+	//Assignment as an operation
+	struct _MatrixSet_ { template<typename T> static constexpr T apply(const T &, const T &b) { return b; } };
+
+	//Operands are held by reference when they are lvalues and by value when they are temporaries,
+	//so a temporary lives as long as the expression does and its buffer can take the result
+	template<typename T>
+	using _MatrixHold_ = std::conditional_t<std::is_lvalue_reference_v<T>, const std::decay_t<T>&, std::decay_t<T>>;
+
+	//Calls func(begin, end) over [0, size), split over the pool when size is large enough
+	template<typename F>
+	void _parallelElements_(const size_t &size, F &&func, const Parallel &par = Parallel::global())
+	{
+		const auto threads = par.count(size);
+		if (threads == 1)
+			func(size_t(0), size);
+		else
+			ThreadPool::global().parallelRange(size, threads, func);
+	}
+
+	//Calls func(x, y) on every element, rows are split over the pool
+	//and walked in square tiles so transposed reads stay in cache
+	template<typename F>
+	void _parallelTiles_(const NumVec<size_t, 2> &dim, F &&func, const Parallel &par = Parallel::global())
+	{
+		constexpr size_t TILE = 32;
+
+		auto rows = [&dim, &func](const size_t &begin, const size_t &end)
+		{
+			for (size_t y0 = begin; y0 < end; y0 += TILE)
+				for (size_t x0 = 0; x0 < dim[0]; x0 += TILE)
+					for (size_t y = y0, yEnd = std::min(y0 + TILE, end); y < yEnd; ++y)
+						for (size_t x = x0, xEnd = std::min(x0 + TILE, dim[0]); x < xEnd; ++x)
+							func(x, y);
+		};
+
+		const auto threads = par.count(dim.product());
+		if (threads == 1)
+			rows(0, dim[1]);
+		else
+			ThreadPool::global().parallelRange(dim[1], threads, rows);
+	}
+
+	//to = e, to is a dense buffer of e's size
+	template<typename E, typename Type>
+	void _evaluateTo_(const E &e, Type *to)
+	{
+		const auto &dim = e.dim();
+
+		if (_contiguousOf_(e))
+			_parallelElements_(dim.product(), [&e, to](const size_t &begin, const size_t &end)
+			{
+				if constexpr (_is_matrix_expr_<E>)
+					e._evaluate_(to, begin, end);
+				else
+					for (size_t i = begin; i < end; ++i)
+						to[i] = e.loc(i);
+			});
+		else
+			_parallelTiles_(dim, [&e, to, w = dim[0]](const size_t &x, const size_t &y) { to[x + w * y] = e(x, y); });
+	}
+
 	template<typename Type, typename Allocator = std::allocator<Type>, 
 		typename = typename std::enable_if_t<std::is_arithmetic_v<Type>>>
 	class Matrix
 	{
 	public:
+		using value_type = Type;
+		using matrix_type = Matrix;
 
 		//-------------------------------------------------------------------------------
 		//------------------------------Constructors-------------------------------------
@@ -49,6 +190,12 @@ namespace ctl
 			, m_dim(m_data.size())
 		{
 		}
+		//Evaluates an expression in one pass or copies a view
+		template<typename Expr, typename = typename std::enable_if_t<_is_matrix_expr_<Expr> || _is_matrix_view_<Expr>>>
+		Matrix(Expr &&e)
+		{
+			_assign_(std::forward<Expr>(e));
+		}
 
 		//~Matrix()
 		//{
@@ -62,7 +209,10 @@ namespace ctl
 		Matrix& operator=(const Matrix &) = default;
 		Matrix& operator=(Matrix &&) = default;
 
-		auto& operator=(const Type &t) { return apply([&](Type &x) { x = t; }); }
+		template<typename Expr, typename = typename std::enable_if_t<_is_matrix_expr_<Expr> || _is_matrix_view_<Expr>>>
+		auto& operator=(Expr &&e) { return _assign_(std::forward<Expr>(e)); }
+
+		auto& operator=(const Type &t) { std::fill(m_data.begin(), m_data.end(), t); return *this; }
 		auto& operator=(const std::initializer_list<Type> &init) { m_data = init; m_dim = { init.size(), 1 }; return *this; }
 
 		auto& operator()(const size_t &x, const size_t &y) { return m_data[x + m_dim[0] * y]; }
@@ -75,82 +225,140 @@ namespace ctl
 
 		const auto& dim() const { return m_dim; }
 
-		//Scalar
+		//Views, these share the buffer and are invalidated when it reallocates
+
+		auto view() { return MatrixView<Type>(m_data.data(), m_dim, { 1, m_dim[0] }); }
+		auto view() const { return MatrixView<const Type>(m_data.data(), m_dim, { 1, m_dim[0] }); }
+
+		auto t() { return view().t(); }
+		auto t() const { return view().t(); }
+
+		auto row(const size_t &y) { return view().row(y); }
+		auto row(const size_t &y) const { return view().row(y); }
+
+		auto col(const size_t &x) { return view().col(x); }
+		auto col(const size_t &x) const { return view().col(x); }
+
+		auto block(const NumVec<size_t, 2> &pos, const NumVec<size_t, 2> &size) { return view().block(pos, size); }
+		auto block(const NumVec<size_t, 2> &pos, const NumVec<size_t, 2> &size) const { return view().block(pos, size); }
+
+		//Scalar, the binary forms are expressions defined below the class
 
-		auto operator+(const Type &x) const { Matrix temp(*this); return temp.apply([&x](Type &y) constexpr { y += x; }); }
-		auto operator-(const Type &x) const { Matrix temp(*this); return temp.apply([&x](Type &y) constexpr { y -= x; }); }
-		auto operator*(const Type &x) const { Matrix temp(*this); return temp.apply([&x](Type &y) constexpr { y *= x; }); }
-		auto operator/(const Type &x) const { Matrix temp(*this); return temp.apply([&x](Type &y) constexpr { y /= x; }); }
+		auto& operator+=(const Type &x) { return _scalar_<Simd::Add>(x); }
+		auto& operator-=(const Type &x) { return _scalar_<Simd::Sub>(x); }
+		auto& operator*=(const Type &x) { return _scalar_<Simd::Mul>(x); }
+		auto& operator/=(const Type &x) { return _scalar_<Simd::Div>(x); }
 
-		auto& operator+=(const Type &x) { return apply([&x](Type &y) constexpr { y += x; }); }
-		auto& operator-=(const Type &x) { return apply([&x](Type &y) constexpr { y -= x; }); }
-		auto& operator*=(const Type &x) { return apply([&x](Type &y) constexpr { y *= x; }); }
-		auto& operator/=(const Type &x) { return apply([&x](Type &y) constexpr { y /= x; }); }
+		//Elementwise, m is a Matrix, view or expression
 
-		//Elementwise
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator+=(const M &m) { return _elementwise_<Simd::Add>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator-=(const M &m) { return _elementwise_<Simd::Sub>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator*=(const M &m) { return _elementwise_<Simd::Mul>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator/=(const M &m) { return _elementwise_<Simd::Div>(m); }
 
 	private:
-		template<typename Arith>
-		auto& _elementwise_(const Matrix &from, Matrix &to, Arith &&arith) const
+		//Vectorized, see Simd.h
+		template<typename Op>
+		auto& _scalar_(const Type &x)
 		{
-			if (from.m_dim != to.m_dim)
+			auto *to = m_data.data();
+			const auto val = x;
+			_parallelElements_(m_data.size(), [to, val](const size_t &begin, const size_t &end)
+			{
+				Simd::scalar<Op>(to + begin, val, to + begin, end - begin);
+			});
+
+			return *this;
+		}
+
+		template<typename Op, typename M>
+		auto& _elementwise_(const M &m)
+		{
+			if (m.dim() != m_dim)
 				throw Log("Matrix: operator elementwise: size differs.", Log::Severity::ERR0R);
 
-			auto iter = from.m_data.begin();
-			return to.apply([&](Type &x) { x = arith(x, *iter++); });
+			auto *to = m_data.data();
+
+			//A view of this matrix would read elements already written
+			if constexpr (_is_viewed_<M>)
+				if (_overlapsOf_(m, to, to + m_data.size()))
+					return _elementwise_<Op>(Matrix(m));
+
+			if (_contiguousOf_(m))
+				_parallelElements_(m_data.size(), [to, &m](const size_t &begin, const size_t &end)
+				{
+					if constexpr (_is_matrix_<M>)
+						Simd::arith<Op>(to + begin, m.data().data() + begin, to + begin, end - begin);
+					else
+						for (size_t i = begin; i < end; ++i)
+							to[i] = Op::apply(to[i], m.loc(i));
+				});
+			else
+				_parallelTiles_(m_dim, [to, &m, w = m_dim[0]](const size_t &x, const size_t &y)
+				{
+					to[x + w * y] = Op::apply(to[x + w * y], m(x, y));
+				});
+
+			return *this;
 		}
 
-	public:
-		auto operator+(const Matrix &m) const { Matrix temp(m); return _elementwise_(*this, temp, std::plus()); }
-		auto operator-(const Matrix &m) const { Matrix temp(m); return _elementwise_(*this, temp, std::minus()); }
-		auto operator*(const Matrix &m) const { Matrix temp(m); return _elementwise_(*this, temp, std::multiplies()); }
-		auto operator/(const Matrix &m) const { Matrix temp(m); return _elementwise_(*this, temp, std::divides()); }
+		//Writes into the current buffer when the size matches, otherwise into
+		//the buffer of a temporary operand of the expression if it has one
+		template<typename Expr>
+		auto& _assign_(Expr &&e)
+		{
+			const auto dim = e.dim();
+			const auto size = dim.product();
+
+			if constexpr (_is_viewed_<Expr>)
+				if (_overlapsOf_(e, m_data.data(), m_data.data() + m_data.size()))
+					return *this = Matrix(std::forward<Expr>(e));
+
+			Matrix *own = nullptr;
+			if constexpr (_is_matrix_expr_<Expr> && !std::is_reference_v<Expr> && std::is_same_v<typename std::decay_t<Expr>::matrix_type, Matrix>)
+				if (m_data.size() != size)
+					own = e._owned_();
+
+			if (!own)
+				m_data.resize(size);
 
-		auto& operator+(Matrix &&m) const { return _elementwise_(*this, m, std::plus()); }
-		auto& operator-(Matrix &&m) const { return _elementwise_(*this, m, std::minus()); }
-		auto& operator*(Matrix &&m) const { return _elementwise_(*this, m, std::multiplies()); }
-		auto& operator/(Matrix &&m) const { return _elementwise_(*this, m, std::divides()); }
+			_evaluateTo_(e, own ? own->m_data.data() : m_data.data());
 
-		auto& operator+=(const Matrix &m) { return _elementwise_(m, *this, std::plus()); }
-		auto& operator-=(const Matrix &m) { return _elementwise_(m, *this, std::minus()); }
-		auto& operator*=(const Matrix &m) { return _elementwise_(m, *this, std::multiplies()); }
-		auto& operator/=(const Matrix &m) { return _elementwise_(m, *this, std::divides()); }
+			if (own)
+				m_data = std::move(own->m_data);
 
+			m_dim = dim;
+			return *this;
+		}
+
+	public:
 		//-------------------------------------------------------------------------------
 		//--------------------------------Methods----------------------------------------
 		//-------------------------------------------------------------------------------
 
-		auto dotProduct(const Matrix &mat2) const
+		//mat2 may be a Matrix or a view, so mat.dotProduct(other.t()) doesn't copy.
+		//Output rows are split over the pool once rows * columns * inner passes par.threshold
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto dotProduct(const M &mat2, const Parallel &par = Parallel::global()) const
 		{
-			if (m_dim[0] != mat2.m_dim[1])
-				throw Log("Matrix: dotProduct: width not same as height.", Log::Severity::ERR0R);
-
-			Matrix<Type, Allocator> mat({ mat2.m_dim[0], m_dim[1] }, 0);
-
-			for (size_t y1 = 0; y1 < m_dim[1]; ++y1)
-				for (size_t x2 = 0; x2 < mat2.m_dim[0]; ++x2)
-					for (size_t x1 = 0; x1 < m_dim[0]; ++x1)
-						mat(x2, y1) += (*this)(x1, y1) * mat2(x2, x1);
-
-			return mat;
+			return _dotProduct_<Matrix>(*this, mat2, par);
 		}
 
+		//Copy, t() is the free version
 		auto transpose() const
 		{
-			Matrix<Type, Allocator> mat(NumVec<size_t, 2>{ m_dim[1], m_dim[0] });
-
-			for (size_t x = 0; x < m_dim[0]; ++x)
-				for (size_t y = 0; y < m_dim[1]; ++y)
-					mat.emplace_back((*this)(x, y));
-
-			return mat;
+			return Matrix<Type, Allocator>(t());
 		}
 
 		template<typename Gen>
 		auto& randomize(ctl::RandomGen<Gen> &gen, const ctl::NumVec<Type, 2> &range)
 		{
 			for (auto& i : m_data)
-				i = gen.randNumber<Type>(range[0], range[1]);
+				i = gen.template randNumber<Type>(range[0], range[1]);
 
 			return *this;
 		}
@@ -160,8 +368,22 @@ namespace ctl
 		template<typename F>
 		auto& apply(F &func)
 		{
-			for (auto& i : m_data)
-				func(i);
+			auto *ptr = m_data.data();
+			for (size_t i = 0, size = m_data.size(); i < size; ++i)
+				func(ptr[i]);
+
+			return *this;
+		}
+		//Split over the pool, func must be safe to call from several threads
+		template<typename F>
+		auto& apply(F &&func, const Parallel &par)
+		{
+			auto *ptr = m_data.data();
+			_parallelElements_(m_data.size(), [ptr, &func](const size_t &begin, const size_t &end)
+			{
+				for (size_t i = begin; i < end; ++i)
+					func(ptr[i]);
+			}, par);
 
 			return *this;
 		}
@@ -206,25 +428,388 @@ namespace ctl
 		ctl::NumVec<size_t, 2> m_dim;
 	};
 
-	//Scalar forwarding
-
-	template<typename Type, typename Allocator>
-	auto operator+(const Type &x, const Matrix<Type, Allocator> &m) { return m + x; }
-	template<typename Type, typename Allocator>
-	auto operator-(const Type &x, const Matrix<Type, Allocator> &m) { return m - x; }
-	template<typename Type, typename Allocator>
-	auto operator*(const Type &x, const Matrix<Type, Allocator> &m) { return m * x; }
-	template<typename Type, typename Allocator>
-	auto operator/(const Type &x, const Matrix<Type, Allocator> &m) { return m / x; }
-
-	//Elementwise forwarding
-
-	template<typename Type, typename Allocator>
-	auto& operator+(Matrix<Type, Allocator> &&m1, Matrix<Type, Allocator> &m2) { return m2 + std::move(m1); }
-	template<typename Type, typename Allocator>
-	auto& operator-(Matrix<Type, Allocator> &&m1, Matrix<Type, Allocator> &m2) { return m2 - std::move(m1); }
-	template<typename Type, typename Allocator>
-	auto& operator*(Matrix<Type, Allocator> &&m1, Matrix<Type, Allocator> &m2) { return m2 * std::move(m1); }
-	template<typename Type, typename Allocator>
-	auto& operator/(Matrix<Type, Allocator> &&m1, Matrix<Type, Allocator> &m2) { return m2 / std::move(m1); }
+	//-------------------------------------------------------------------------------
+	//-------------------------------MatrixView--------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//Non owning window into a matrix buffer with its own offset, strides and size.
+	//Element (x, y) is data[offset + x * stride[0] + y * stride[1]].
+	template<typename Type>
+	class MatrixView
+	{
+	public:
+		using value_type = std::remove_const_t<Type>;
+		using matrix_type = Matrix<value_type>;
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		MatrixView(Type *data, const NumVec<size_t, 2> &dim, const NumVec<size_t, 2> &stride, const size_t &offset = 0)
+			: m_data(data)
+			, m_dim(dim)
+			, m_stride(stride)
+			, m_offset(offset)
+		{
+		}
+		MatrixView(const MatrixView &) = default;
+
+		//Read only view of a writable one
+		template<typename T, typename = typename std::enable_if_t<std::is_same_v<const T, Type> && !std::is_same_v<T, Type>>>
+		MatrixView(const MatrixView<T> &v)
+			: MatrixView(v.ptr(), v.dim(), v.stride(), v.offset())
+		{
+		}
+
+		//---------------------------------------------------------
+		//----------------------Operators--------------------------
+		//---------------------------------------------------------
+
+		//Assignment writes through the view
+
+		auto& operator=(const MatrixView &m) { return _write_<_MatrixSet_>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator=(const M &m) { return _write_<_MatrixSet_>(m); }
+		auto& operator=(const value_type &x) { return _writeScalar_<_MatrixSet_>(x); }
+
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator+=(const M &m) { return _write_<Simd::Add>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator-=(const M &m) { return _write_<Simd::Sub>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator*=(const M &m) { return _write_<Simd::Mul>(m); }
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto& operator/=(const M &m) { return _write_<Simd::Div>(m); }
+
+		auto& operator+=(const value_type &x) { return _writeScalar_<Simd::Add>(x); }
+		auto& operator-=(const value_type &x) { return _writeScalar_<Simd::Sub>(x); }
+		auto& operator*=(const value_type &x) { return _writeScalar_<Simd::Mul>(x); }
+		auto& operator/=(const value_type &x) { return _writeScalar_<Simd::Div>(x); }
+
+		auto& operator()(const size_t &x, const size_t &y) const { return m_data[m_offset + x * m_stride[0] + y * m_stride[1]]; }
+
+		//Linear index, only meaningful when contiguous
+		auto& loc(const size_t &xy) const { return m_data[m_offset + xy]; }
+
+		const auto& dim() const { return m_dim; }
+		const auto& stride() const { return m_stride; }
+		const auto& offset() const { return m_offset; }
+		auto* ptr() const { return m_data; }
+
+		bool contiguous() const { return m_stride[0] == 1 && (m_stride[1] == m_dim[0] || m_dim[1] == 1); }
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		auto t() const { return MatrixView(m_data, { m_dim[1], m_dim[0] }, { m_stride[1], m_stride[0] }, m_offset); }
+
+		auto row(const size_t &y) const
+		{
+			if (y >= m_dim[1])
+				throw Log("MatrixView: row: out of range.", Log::Severity::ERR0R);
+
+			return MatrixView(m_data, { m_dim[0], 1 }, m_stride, m_offset + y * m_stride[1]);
+		}
+
+		auto col(const size_t &x) const
+		{
+			if (x >= m_dim[0])
+				throw Log("MatrixView: col: out of range.", Log::Severity::ERR0R);
+
+			return MatrixView(m_data, { 1, m_dim[1] }, m_stride, m_offset + x * m_stride[0]);
+		}
+
+		auto block(const NumVec<size_t, 2> &pos, const NumVec<size_t, 2> &size) const
+		{
+			if (pos[0] + size[0] > m_dim[0] || pos[1] + size[1] > m_dim[1])
+				throw Log("MatrixView: block: out of range.", Log::Severity::ERR0R);
+
+			return MatrixView(m_data, size, m_stride, m_offset + pos[0] * m_stride[0] + pos[1] * m_stride[1]);
+		}
+
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto dotProduct(const M &mat2, const Parallel &par = Parallel::global()) const
+		{
+			return _dotProduct_<matrix_type>(*this, mat2, par);
+		}
+
+		//Lazy, as on expressions
+		template<typename F>
+		auto apply(F &&func) const { return _MatrixApply_<MatrixView, F>(MatrixView(*this), std::forward<F>(func)); }
+
+		auto eval() const { return matrix_type(*this); }
+
+		bool _overlaps_(const value_type *begin, const value_type *end) const
+		{
+			return m_dim.product() != 0 && _first_() < end && begin <= _last_();
+		}
+
+		//Memory [first, last) the view can reach
+		std::pair<const value_type*, const value_type*> _extent_() const { return { _first_(), _last_() + 1 }; }
+
+	private:
+		template<typename Op, typename M>
+		MatrixView& _write_(const M &m)
+		{
+			static_assert(!std::is_const_v<Type>, "MatrixView: writing through a read only view.");
+
+			if (m.dim() != m_dim)
+				throw Log("MatrixView: operator elementwise: size differs.", Log::Severity::ERR0R);
+
+			//Read everything before writing when the source shares memory with the view
+			if (_overlapsOf_(m, _first_(), _last_() + 1))
+				return _write_<Op>(matrix_type(m));
+
+			_parallelTiles_(m_dim, [this, &m](const size_t &x, const size_t &y)
+			{
+				auto &to = (*this)(x, y);
+				to = Op::apply(static_cast<value_type>(to), static_cast<value_type>(m(x, y)));
+			});
+
+			return *this;
+		}
+
+		template<typename Op>
+		auto& _writeScalar_(const value_type x)
+		{
+			static_assert(!std::is_const_v<Type>, "MatrixView: writing through a read only view.");
+
+			_parallelTiles_(m_dim, [this, x](const size_t &i, const size_t &j)
+			{
+				auto &to = (*this)(i, j);
+				to = Op::apply(static_cast<value_type>(to), x);
+			});
+
+			return *this;
+		}
+
+		const value_type* _first_() const { return m_data + m_offset; }
+		const value_type* _last_() const { return m_dim.product() == 0 ? _first_() - 1 : _first_() + (m_dim[0] - 1) * m_stride[0] + (m_dim[1] - 1) * m_stride[1]; }
+
+		Type *m_data;
+		NumVec<size_t, 2> m_dim;
+		NumVec<size_t, 2> m_stride;
+		size_t m_offset;
+	};
+
+	//mat1 x mat2 into a new Result, either side may be a Matrix, view or expression
+	template<typename Result, typename M1, typename M2>
+	Result _dotProduct_(const M1 &mat1, const M2 &mat2, const Parallel &par)
+	{
+		static_assert(std::is_same_v<typename Result::value_type, typename std::decay_t<M2>::value_type>, "Matrix: dotProduct: element types differ.");
+
+		if constexpr (_is_matrix_expr_<M2>)
+			return _dotProduct_<Result>(mat1, typename std::decay_t<M2>::matrix_type(mat2), par);
+		else
+		{
+			if (mat1.dim()[0] != mat2.dim()[1])
+				throw Log("Matrix: dotProduct: width not same as height.", Log::Severity::ERR0R);
+
+			Result mat({ mat2.dim()[0], mat1.dim()[1] }, 0);
+			if (mat.dim().product() == 0)
+				return mat;
+
+			//Blocked and packed, see Gemm.h
+			_gemmParallel_(mat1.dim()[1], mat2.dim()[0], mat1.dim()[0],
+				_gemmOperandOf_(mat1), _gemmOperandOf_(mat2),
+				&mat.loc(0), mat.dim()[0], par);
+
+			return mat;
+		}
+	}
+
+	//-------------------------------------------------------------------------------
+	//------------------------------Expressions--------------------------------------
+	//-------------------------------------------------------------------------------
+
+	template<typename Derived, typename MatrixType>
+	class _MatrixExpr_ : public _MatrixExprTag_
+	{
+	public:
+		using value_type = typename MatrixType::value_type;
+		using matrix_type = MatrixType;
+
+		//Lazy, func gets a copy of each element and is fused into the same loop
+		template<typename F>
+		auto apply(F &&func) const & { return _MatrixApply_<const Derived&, F>(_derived_(), std::forward<F>(func)); }
+		template<typename F>
+		auto apply(F &&func) && { return _MatrixApply_<Derived, F>(std::move(_derived_()), std::forward<F>(func)); }
+
+		matrix_type eval() const & { return matrix_type(_derived_()); }
+		matrix_type eval() && { return matrix_type(std::move(_derived_())); }
+
+		//Writes elements [begin, end)
+		void _evaluate_(value_type *to, const size_t &begin, const size_t &end) const
+		{
+			const auto &e = _derived_();
+			for (size_t i = begin; i < end; ++i)
+				to[i] = e.loc(i);
+		}
+
+	protected:
+		template<typename M>
+		static matrix_type* _ownedOf_(M &m)
+		{
+			if constexpr (std::is_reference_v<M> || _is_matrix_view_<M>)
+				return nullptr;
+			else if constexpr (_is_matrix_<M>)
+				return &m;
+			else
+				return m._owned_();
+		}
+
+	private:
+		Derived& _derived_() { return static_cast<Derived&>(*this); }
+		const Derived& _derived_() const { return static_cast<const Derived&>(*this); }
+	};
+
+	//l op r
+	template<typename Op, typename L, typename R>
+	class _MatrixBinary_ : public _MatrixExpr_<_MatrixBinary_<Op, L, R>, typename std::decay_t<L>::matrix_type>
+	{
+	public:
+		_MatrixBinary_(L &&l, R &&r)
+			: m_l(std::forward<L>(l))
+			, m_r(std::forward<R>(r))
+		{
+			if (m_l.dim() != m_r.dim())
+				throw Log("Matrix: operator elementwise: size differs.", Log::Severity::ERR0R);
+		}
+
+		static constexpr bool viewed = _is_viewed_<L> || _is_viewed_<R>;
+
+		const auto& dim() const { return m_l.dim(); }
+		auto loc(const size_t &xy) const { return Op::template apply<typename _MatrixBinary_::value_type>(m_l.loc(xy), m_r.loc(xy)); }
+		auto operator()(const size_t &x, const size_t &y) const { return Op::template apply<typename _MatrixBinary_::value_type>(m_l(x, y), m_r(x, y)); }
+
+		bool contiguous() const { return _contiguousOf_(m_l) && _contiguousOf_(m_r); }
+		template<typename T>
+		bool _overlaps_(const T *begin, const T *end) const { return _overlapsOf_(m_l, begin, end) || _overlapsOf_(m_r, begin, end); }
+
+		void _evaluate_(typename _MatrixBinary_::value_type *to, const size_t &begin, const size_t &end) const
+		{
+			if constexpr (_is_matrix_<L> && _is_matrix_<R>)
+				Simd::arith<Op>(m_l.data().data() + begin, m_r.data().data() + begin, to + begin, end - begin);
+			else
+				_MatrixBinary_::_MatrixExpr_::_evaluate_(to, begin, end);
+		}
+
+		auto _owned_()
+		{
+			auto *own = this->template _ownedOf_<_MatrixHold_<L>>(m_l);
+			return own ? own : this->template _ownedOf_<_MatrixHold_<R>>(m_r);
+		}
+
+	private:
+		_MatrixHold_<L> m_l;
+		_MatrixHold_<R> m_r;
+	};
+
+	//e op x, or x op e when swapped
+	template<typename Op, bool swap, typename E>
+	class _MatrixScalar_ : public _MatrixExpr_<_MatrixScalar_<Op, swap, E>, typename std::decay_t<E>::matrix_type>
+	{
+	public:
+		using value_type = typename _MatrixScalar_::value_type;
+
+		_MatrixScalar_(E &&e, const value_type &x)
+			: m_e(std::forward<E>(e))
+			, m_x(x)
+		{
+		}
+
+		static constexpr bool viewed = _is_viewed_<E>;
+
+		const auto& dim() const { return m_e.dim(); }
+		auto loc(const size_t &xy) const { return swap ? Op::apply(m_x, value_type(m_e.loc(xy))) : Op::apply(value_type(m_e.loc(xy)), m_x); }
+		auto operator()(const size_t &x, const size_t &y) const { return swap ? Op::apply(m_x, value_type(m_e(x, y))) : Op::apply(value_type(m_e(x, y)), m_x); }
+
+		bool contiguous() const { return _contiguousOf_(m_e); }
+		template<typename T>
+		bool _overlaps_(const T *begin, const T *end) const { return _overlapsOf_(m_e, begin, end); }
+
+		void _evaluate_(value_type *to, const size_t &begin, const size_t &end) const
+		{
+			if constexpr (_is_matrix_<E>)
+				Simd::scalar<Op, swap>(m_e.data().data() + begin, m_x, to + begin, end - begin);
+			else
+				_MatrixScalar_::_MatrixExpr_::_evaluate_(to, begin, end);
+		}
+
+		auto _owned_() { return this->template _ownedOf_<_MatrixHold_<E>>(m_e); }
+
+	private:
+		_MatrixHold_<E> m_e;
+		value_type m_x;
+	};
+
+	//func(e)
+	template<typename E, typename F>
+	class _MatrixApply_ : public _MatrixExpr_<_MatrixApply_<E, F>, typename std::decay_t<E>::matrix_type>
+	{
+	public:
+		_MatrixApply_(E &&e, F &&func)
+			: m_e(std::forward<E>(e))
+			, m_func(std::forward<F>(func))
+		{
+		}
+
+		static constexpr bool viewed = _is_viewed_<E>;
+
+		const auto& dim() const { return m_e.dim(); }
+		auto loc(const size_t &xy) const
+		{
+			typename _MatrixApply_::value_type x = m_e.loc(xy);
+			m_func(x);
+			return x;
+		}
+		auto operator()(const size_t &x, const size_t &y) const
+		{
+			typename _MatrixApply_::value_type val = m_e(x, y);
+			m_func(val);
+			return val;
+		}
+
+		bool contiguous() const { return _contiguousOf_(m_e); }
+		template<typename T>
+		bool _overlaps_(const T *begin, const T *end) const { return _overlapsOf_(m_e, begin, end); }
+
+		auto _owned_() { return this->template _ownedOf_<_MatrixHold_<E>>(m_e); }
+
+	private:
+		_MatrixHold_<E> m_e;
+		mutable std::decay_t<F> m_func;
+	};
+
+	//Scalar
+
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator+(E &&e, const typename std::decay_t<E>::value_type &x) { return _MatrixScalar_<Simd::Add, false, E>(std::forward<E>(e), x); }
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator-(E &&e, const typename std::decay_t<E>::value_type &x) { return _MatrixScalar_<Simd::Sub, false, E>(std::forward<E>(e), x); }
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator*(E &&e, const typename std::decay_t<E>::value_type &x) { return _MatrixScalar_<Simd::Mul, false, E>(std::forward<E>(e), x); }
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator/(E &&e, const typename std::decay_t<E>::value_type &x) { return _MatrixScalar_<Simd::Div, false, E>(std::forward<E>(e), x); }
+
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator+(const typename std::decay_t<E>::value_type &x, E &&e) { return _MatrixScalar_<Simd::Add, true, E>(std::forward<E>(e), x); }
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator-(const typename std::decay_t<E>::value_type &x, E &&e) { return _MatrixScalar_<Simd::Sub, true, E>(std::forward<E>(e), x); }
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator*(const typename std::decay_t<E>::value_type &x, E &&e) { return _MatrixScalar_<Simd::Mul, true, E>(std::forward<E>(e), x); }
+	template<typename E, typename = typename std::enable_if_t<_is_matrix_operand_<E>>>
+	auto operator/(const typename std::decay_t<E>::value_type &x, E &&e) { return _MatrixScalar_<Simd::Div, true, E>(std::forward<E>(e), x); }
+
+	//Elementwise
+
+	template<typename L, typename R, typename = typename std::enable_if_t<_is_matrix_operand_<L> && _is_matrix_operand_<R>>>
+	auto operator+(L &&l, R &&r) { return _MatrixBinary_<Simd::Add, L, R>(std::forward<L>(l), std::forward<R>(r)); }
+	template<typename L, typename R, typename = typename std::enable_if_t<_is_matrix_operand_<L> && _is_matrix_operand_<R>>>
+	auto operator-(L &&l, R &&r) { return _MatrixBinary_<Simd::Sub, L, R>(std::forward<L>(l), std::forward<R>(r)); }
+	template<typename L, typename R, typename = typename std::enable_if_t<_is_matrix_operand_<L> && _is_matrix_operand_<R>>>
+	auto operator*(L &&l, R &&r) { return _MatrixBinary_<Simd::Mul, L, R>(std::forward<L>(l), std::forward<R>(r)); }
+	template<typename L, typename R, typename = typename std::enable_if_t<_is_matrix_operand_<L> && _is_matrix_operand_<R>>>
+	auto operator/(L &&l, R &&r) { return _MatrixBinary_<Simd::Div, L, R>(std::forward<L>(l), std::forward<R>(r)); }
 }
\ No newline at end of file
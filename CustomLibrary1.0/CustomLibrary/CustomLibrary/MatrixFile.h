@@ -0,0 +1,303 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include "Matrix.h"
+#include "Error.h"
+
+//Binary Matrix files: a 64 byte header, then the elements row major starting at an aligned offset.
+//Files in the reader's byte order are memory mapped and viewed in place, others are copied and swapped.
+
+namespace ctl
+{
+	enum class MatrixFileType : uint8_t { INT8, UINT8, INT16, UINT16, INT32, UINT32, INT64, UINT64, FLOAT32, FLOAT64 };
+
+	template<typename Type>
+	constexpr MatrixFileType _matrixFileType_()
+	{
+		static_assert(std::is_arithmetic_v<Type> && !std::is_same_v<Type, bool> && sizeof(Type) <= 8, "MatrixFile: unsupported element type.");
+
+		if constexpr (std::is_floating_point_v<Type>)
+			return sizeof(Type) == 4 ? MatrixFileType::FLOAT32 : MatrixFileType::FLOAT64;
+		else if constexpr (sizeof(Type) == 1)
+			return std::is_signed_v<Type> ? MatrixFileType::INT8 : MatrixFileType::UINT8;
+		else if constexpr (sizeof(Type) == 2)
+			return std::is_signed_v<Type> ? MatrixFileType::INT16 : MatrixFileType::UINT16;
+		else if constexpr (sizeof(Type) == 4)
+			return std::is_signed_v<Type> ? MatrixFileType::INT32 : MatrixFileType::UINT32;
+		else
+			return std::is_signed_v<Type> ? MatrixFileType::INT64 : MatrixFileType::UINT64;
+	}
+
+	struct MatrixFileHeader
+	{
+		static constexpr uint32_t VERSION = 1;
+		//Reads back as 0x04030201 on a machine of the other byte order
+		static constexpr uint32_t ENDIAN = 0x01020304;
+		//Data starts on a multiple of this, so mapped data is cache line and SIMD aligned
+		static constexpr uint32_t ALIGNMENT = 64;
+
+		char magic[4] = { 'C', 'T', 'L', 'M' };
+		uint32_t version = VERSION;
+		uint32_t endian = ENDIAN;
+		MatrixFileType type = MatrixFileType::FLOAT64;
+		uint8_t elementSize = 0;
+		uint16_t reserved0 = 0;
+		uint32_t alignment = ALIGNMENT;
+		uint32_t reserved1 = 0;
+		uint64_t width = 0;
+		uint64_t height = 0;
+		uint64_t offset = 0;
+		uint8_t reserved2[16] = {};
+	};
+	static_assert(sizeof(MatrixFileHeader) == 64 && std::is_trivially_copyable_v<MatrixFileHeader>, "MatrixFile: header layout.");
+
+	template<typename Type>
+	Type _byteSwap_(const Type &x)
+	{
+		Type swapped;
+		const auto *from = reinterpret_cast<const unsigned char*>(&x);
+		auto *to = reinterpret_cast<unsigned char*>(&swapped);
+		for (size_t i = 0; i < sizeof(Type); ++i)
+			to[i] = from[sizeof(Type) - 1 - i];
+		return swapped;
+	}
+
+	//Checks a header read from a file of fileSize bytes, swapping it to this machine's order.
+	//Returns whether the data has to be swapped too
+	template<typename Type>
+	bool _checkHeader_(MatrixFileHeader &header, const uint64_t &fileSize, const char *method)
+	{
+		const std::string where = std::string("MatrixFile: ") + method + ": ";
+
+		if (std::memcmp(header.magic, "CTLM", 4) != 0)
+			throw Log(where + "not a matrix file.", Log::Severity::ERR0R);
+
+		const bool swap = header.endian != MatrixFileHeader::ENDIAN;
+		if (swap)
+		{
+			if (_byteSwap_(header.endian) != MatrixFileHeader::ENDIAN)
+				throw Log(where + "unknown byte order.", Log::Severity::ERR0R);
+
+			header.version = _byteSwap_(header.version);
+			header.alignment = _byteSwap_(header.alignment);
+			header.width = _byteSwap_(header.width);
+			header.height = _byteSwap_(header.height);
+			header.offset = _byteSwap_(header.offset);
+		}
+
+		if (header.version > MatrixFileHeader::VERSION)
+			throw Log(where + "newer file version.", Log::Severity::ERR0R);
+		if (header.type != _matrixFileType_<Type>() || header.elementSize != sizeof(Type))
+			throw Log(where + "element type differs.", Log::Severity::ERR0R);
+		//A crafted size could wrap the product below the file size
+		if ((header.width != 0 && header.height > UINT64_MAX / header.width) || header.width * header.height > SIZE_MAX / sizeof(Type))
+			throw Log(where + "size is too large.", Log::Severity::ERR0R);
+		if (header.offset < sizeof(MatrixFileHeader) || fileSize < header.offset || (fileSize - header.offset) / sizeof(Type) < header.width * header.height)
+			throw Log(where + "file is truncated.", Log::Severity::ERR0R);
+
+		return swap;
+	}
+
+	//Writes a Matrix, view or expression
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	void saveMatrix(const std::string &path, const M &mat)
+	{
+		using Type = typename std::decay_t<M>::value_type;
+
+		if constexpr (!_is_matrix_<M>)
+			return saveMatrix(path, Matrix<Type>(mat));
+		else
+		{
+			MatrixFileHeader header;
+			header.type = _matrixFileType_<Type>();
+			header.elementSize = sizeof(Type);
+			header.width = mat.dim()[0];
+			header.height = mat.dim()[1];
+			header.offset = (sizeof(MatrixFileHeader) + header.alignment - 1) / header.alignment * header.alignment;
+
+			std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file)
+				throw Log("MatrixFile: saveMatrix: can't open " + path + '.', Log::Severity::ERR0R);
+
+			const char padding[MatrixFileHeader::ALIGNMENT] = {};
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(padding, header.offset - sizeof(header));
+			file.write(reinterpret_cast<const char*>(mat.data().data()), mat.data().size() * sizeof(Type));
+
+			if (!file)
+				throw Log("MatrixFile: saveMatrix: write failed for " + path + '.', Log::Severity::ERR0R);
+		}
+	}
+
+	//Reads a file into a new Matrix, swapping bytes if it was written on a machine of the other order
+	template<typename Type, typename Allocator = std::allocator<Type>>
+	Matrix<Type, Allocator> loadMatrix(const std::string &path)
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+		if (!file)
+			throw Log("MatrixFile: loadMatrix: can't open " + path + '.', Log::Severity::ERR0R);
+
+		const uint64_t fileSize = file.tellg();
+		file.seekg(0);
+
+		MatrixFileHeader header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			throw Log("MatrixFile: loadMatrix: file is truncated.", Log::Severity::ERR0R);
+		const bool swap = _checkHeader_<Type>(header, fileSize, "loadMatrix");
+
+		Matrix<Type, Allocator> mat({ size_t(header.width), size_t(header.height) }, 0);
+		file.seekg(header.offset);
+		if (mat.dim().product() != 0 && !file.read(reinterpret_cast<char*>(&mat.loc(0)), mat.dim().product() * sizeof(Type)))
+			throw Log("MatrixFile: loadMatrix: read failed for " + path + '.', Log::Severity::ERR0R);
+
+		if (swap)
+			for (size_t i = 0; i < mat.dim().product(); ++i)
+				mat.loc(i) = _byteSwap_(mat.loc(i));
+
+		return mat;
+	}
+
+	//Read only mapping of a whole file, unmapped when destroyed
+	class MappedFile
+	{
+	public:
+		MappedFile(const std::string &path)
+		{
+#ifdef _WIN32
+			m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			LARGE_INTEGER size;
+			if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size))
+			{
+				_close_();
+				throw Log("MappedFile: constructor: can't open " + path + '.', Log::Severity::ERR0R);
+			}
+			m_size = size_t(size.QuadPart);
+
+			if (m_size != 0)
+			{
+				m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				m_data = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+				if (!m_data)
+				{
+					_close_();
+					throw Log("MappedFile: constructor: can't map " + path + '.', Log::Severity::ERR0R);
+				}
+			}
+#else
+			const int file = ::open(path.c_str(), O_RDONLY);
+			struct stat info;
+			if (file < 0 || ::fstat(file, &info) != 0)
+			{
+				if (file >= 0)
+					::close(file);
+				throw Log("MappedFile: constructor: can't open " + path + '.', Log::Severity::ERR0R);
+			}
+			m_size = size_t(info.st_size);
+
+			if (m_size != 0)
+			{
+				m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file, 0);
+				if (m_data == MAP_FAILED)
+				{
+					m_data = nullptr;
+					::close(file);
+					throw Log("MappedFile: constructor: can't map " + path + '.', Log::Severity::ERR0R);
+				}
+			}
+			//The mapping keeps the file alive
+			::close(file);
+#endif // _WIN32
+		}
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile& operator=(const MappedFile &) = delete;
+
+		~MappedFile() { _close_(); }
+
+		const void* data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		void _close_()
+		{
+#ifdef _WIN32
+			if (m_data)
+				UnmapViewOfFile(m_data);
+			if (m_mapping)
+				CloseHandle(m_mapping);
+			if (m_file != INVALID_HANDLE_VALUE)
+				CloseHandle(m_file);
+#else
+			if (m_data)
+				::munmap(m_data, m_size);
+#endif // _WIN32
+			m_data = nullptr;
+		}
+
+#ifdef _WIN32
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#endif // _WIN32
+		void *m_data = nullptr;
+		size_t m_size = 0;
+	};
+
+	//Matrix file mapped read only, view() reads the file's pages directly.
+	//Copies share the mapping, which lives until the last one is gone.
+	template<typename Type>
+	class MappedMatrix
+	{
+	public:
+		MappedMatrix(const std::string &path)
+			: m_file(std::make_shared<MappedFile>(path))
+		{
+			MatrixFileHeader header;
+			if (m_file->size() < sizeof(header))
+				throw Log("MatrixFile: mapMatrix: file is truncated.", Log::Severity::ERR0R);
+
+			std::memcpy(&header, m_file->data(), sizeof(header));
+			if (_checkHeader_<Type>(header, m_file->size(), "mapMatrix"))
+				throw Log("MatrixFile: mapMatrix: byte order differs, use loadMatrix.", Log::Severity::ERR0R);
+			if (header.offset % alignof(Type) != 0)
+				throw Log("MatrixFile: mapMatrix: data is misaligned.", Log::Severity::ERR0R);
+
+			m_dim = { size_t(header.width), size_t(header.height) };
+			m_data = reinterpret_cast<const Type*>(static_cast<const char*>(m_file->data()) + header.offset);
+		}
+
+		const auto& dim() const { return m_dim; }
+		const Type* data() const { return m_data; }
+
+		//Valid while this or a copy of it exists
+		auto view() const { return MatrixView<const Type>(m_data, m_dim, { 1, m_dim[0] }); }
+
+		auto toMatrix() const { return Matrix<Type>(view()); }
+
+	private:
+		std::shared_ptr<MappedFile> m_file;
+		const Type *m_data;
+		NumVec<size_t, 2> m_dim;
+	};
+
+	template<typename Type>
+	MappedMatrix<Type> mapMatrix(const std::string &path) { return MappedMatrix<Type>(path); }
+}
\ No newline at end of file
@@ -1,14 +1,67 @@
 #pragma once
 
 #include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
 
 #include "Vector.h"
 #include "RandomGenerator.h"
 #include "utility.h"
 #include "Matrix.h"
+#include "Blas.h"
+#include "NeuralNetFile.h"
+#include "Activation.h"
 
 namespace ctl
 {
+	//How trainParallel combines the work of its threads
+	enum class Training { SYNCHRONOUS, HOGWILD };
+
+	//How trainBatch and trainParallel turn a gradient into a step, see Simd::StepCoefficients.
+	//MOMENTUM keeps a velocity per weight, RMSPROP a mean square gradient and ADAM both
+	struct Optimizer
+	{
+		enum class Type : uint8_t { SGD, MOMENTUM, RMSPROP, ADAM };
+
+		Type type = Type::SGD;
+		double decay1 = 0.9;
+		double decay2 = 0.999;
+		double epsilon = 1e-8;
+
+		static Optimizer sgd() { return Optimizer(); }
+		static Optimizer momentum(const double &momentum = 0.9) { return { Type::MOMENTUM, momentum }; }
+		static Optimizer rmsProp(const double &decay = 0.9, const double &epsilon = 1e-8) { return { Type::RMSPROP, 0, decay, epsilon }; }
+		static Optimizer adam(const double &beta1 = 0.9, const double &beta2 = 0.999, const double &epsilon = 1e-8) { return { Type::ADAM, beta1, beta2, epsilon }; }
+	};
+
+	//Result of NeuralNet::evaluate. A sample is correct when its largest output is its first true target,
+	//or for a single output when it is above 0.5 exactly when the target is true
+	struct Evaluation
+	{
+		//Sum of squared errors
+		double cost = 0;
+		size_t correct = 0;
+		size_t samples = 0;
+
+		double accuracy() const { return samples == 0 ? 0 : double(correct) / samples; }
+	};
+
+	//Whether each connection's weights are neurons[i] wide by neurons[i + 1] high and its bias 1 by neurons[i + 1].
+	//A net built from only its neurons has empty matrices until open loads them
+	template<typename Connections>
+	bool _matchesNeurons_(const std::vector<size_t> &neurons, const Connections &connections)
+	{
+		if (neurons.size() < 2 || connections.size() != neurons.size() - 1)
+			return false;
+
+		for (size_t i = 0; i < connections.size(); ++i)
+			if (connections[i][0].dim() != NumVec<size_t, 2>{ neurons[i], neurons[i + 1] } || connections[i][1].dim() != NumVec<size_t, 2>{ 1, neurons[i + 1] })
+				return false;
+
+		return true;
+	}
+
 	class NeuralNet
 	{
 	public:
@@ -22,10 +75,12 @@ namespace ctl
 		NeuralNet(const NeuralNet &) = default;
 		NeuralNet(NeuralNet &&) = default;
 
+		//activations has one entry per connection, all are SIGMOID when it's empty
 		template<typename Gen>
-		NeuralNet(const std::initializer_list<size_t> &neurons, const ctl::NumVec<double, 2> &initRange, RandomGen<Gen> &rand)
+		NeuralNet(const std::initializer_list<size_t> &neurons, const ctl::NumVec<double, 2> &initRange, RandomGen<Gen> &rand, const std::initializer_list<Activation> &activations = {})
 			: m_neurons(neurons.begin(), neurons.end())
 		{
+			_setActivations_(activations);
 			m_connections.reserve(m_neurons.size() - 1);
 
 			for (auto i = m_neurons.begin(), length = m_neurons.end() - 1; i != length; ++i)
@@ -33,9 +88,10 @@ namespace ctl
 					Matrix<double>({ *i, *(i + 1) }, 0.).randomize(rand, initRange),
 					Matrix<double>({ 1, *(i + 1) }, 0.).randomize(rand, initRange) });
 		}
-		NeuralNet(const std::initializer_list<size_t> &neurons)
+		NeuralNet(const std::initializer_list<size_t> &neurons, const std::initializer_list<Activation> &activations = {})
 			: m_neurons(neurons.begin(), neurons.end())
 		{
+			_setActivations_(activations);
 			m_connections.reserve(m_neurons.size() - 1);
 
 			for (size_t i = 0, length = m_neurons.size() - 1; i < length; ++i)
@@ -51,62 +107,145 @@ namespace ctl
 
 		const auto& neurons() const { return m_neurons; }
 		const auto& connections() const { return m_connections; }
+		const auto& activations() const { return m_activations; }
+
+		//Activation of the outputs of connection layer
+		auto& activation(const size_t &layer, const Activation &act)
+		{
+			if (layer >= m_activations.size())
+				throw Log("Neural Network: activation: layer out of range.", Log::Severity::ERR0R);
+
+			m_activations[layer] = act;
+			return *this;
+		}
+
+		const auto& optimizer() const { return m_optimizer; }
+
+		//Starts the optimizer over, dropping any moments of the previous one
+		auto& optimizer(const Optimizer &opt)
+		{
+			m_optimizer = opt;
+			m_moments.clear();
+			m_steps = 0;
+			return *this;
+		}
 
 		//---------------------------------------------------------
 		//------------------------Methods--------------------------
 		//---------------------------------------------------------
 
+		//One step of the optimizer on the mean gradient of [begin, end).
+		//Samples are the columns of one matrix per layer, so each pass is a GEMM instead of a GEMV per sample.
+		//Layer matrices are kept between calls and only reallocated when the batch size changes
+		template<typename Iter, typename = typename std::enable_if_t<std::is_same_v<typename std::iterator_traits<Iter>::value_type, Data>>>
+		auto& trainBatch(Iter begin, const Iter &end, const double &learnRate, const Parallel &par = Parallel::global())
+		{
+			if (m_workspaces.empty())
+				m_workspaces.resize(1);
+
+			const auto batch = _propagate_(m_workspaces.front(), begin, end, "trainBatch", par);
+			if (batch != 0)
+				_step_(m_workspaces.front(), learnRate, batch, ++m_steps, par);
+
+			return *this;
+		}
+
+		//A step on one sample, the same as trainBatch on a batch of it
 		auto& train(const Data &d, const double &learnRate)
 		{
 			if (d.first.size() != m_neurons.front() || d.second.size() != m_neurons.back())
 				throw Log("Neural Network: train: Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
 
-			//Calculate output and store it
-			std::vector<Matrix<double>> neuronOutput;
-			neuronOutput.reserve(m_neurons.size());
-
-			neuronOutput.emplace_back(d.first.begin(), d.first.end());
+			trainBatch(&d, &d + 1, learnRate);
+			return *this;
+		}
 
-			for (size_t i = 0, length = neuronOutput.capacity() - 1; i < length; ++i)
-				neuronOutput.emplace_back((m_connections[i][0].dotProduct(neuronOutput[i]) + m_connections[i][1]).apply(sigmoid));
+		//One epoch over [begin, end) in mini batches of batchSize, with shards of the data on the threads of par.
+		//SYNCHRONOUS splits each mini batch over the threads and sums their gradients into one step,
+		//the same step trainBatch takes on the whole mini batch.
+		//HOGWILD gives every thread a contiguous shard it steps through on its own, updating the shared weights
+		//without locks. Updates of other threads can be missed or seen half applied, which sparse enough
+		//gradients tolerate, in exchange for never waiting. Relies on doubles not tearing, as on x86 and ARM
+		template<typename Iter, typename = typename std::enable_if_t<std::is_same_v<typename std::iterator_traits<Iter>::value_type, Data>>>
+		auto& trainParallel(Iter begin, const Iter &end, const double &learnRate, const size_t &batchSize, const Training &mode = Training::SYNCHRONOUS, const Parallel &par = Parallel::global())
+		{
+			if (batchSize == 0)
+				throw Log("Neural Network: trainParallel: batch size is 0.", Log::Severity::ERR0R);
 
+			const auto size = size_t(std::distance(begin, end));
 
-			//Calculate output error
-			Matrix<double> o_Error(NumVec<size_t, 2>{ 1, m_neurons.back() });
-			for (size_t i = 0; i < m_neurons.back(); ++i)
-				o_Error.emplace_back(neuronOutput.back()(0, i) - d.second[i]);
+			//Operations of one sample, weights are used in both passes
+			size_t weights = 0;
+			for (const auto &i : m_connections)
+				weights += i[0].dim().product();
 
+			if (mode == Training::HOGWILD)
+			{
+				const auto threads = std::min(par.count(size * weights), (size + batchSize - 1) / std::max<size_t>(1, batchSize));
+				if (threads <= 1)
+				{
+					for (size_t i = 0; i < size; i += batchSize)
+						trainBatch(std::next(begin, i), std::next(begin, std::min(size, i + batchSize)), learnRate, par);
+					return *this;
+				}
 
-			//Calculate output errors
-			std::vector<Matrix<double>> output_errors;
-			output_errors.reserve(m_connections.size());
+				if (m_workspaces.size() < threads)
+					m_workspaces.resize(threads);
+				_reserveMoments_();
 
-			output_errors.emplace_back(std::move(o_Error));
+				//Moments are shared like the weights. Steps are counted as if the threads went in turn
+				const auto steps = m_steps;
+				ThreadPool::global().parallelFor(threads, [&](const size_t &t)
+				{
+					const auto first = size * t / threads, last = size * (t + 1) / threads;
+					for (size_t i = first; i < last; i += batchSize)
+					{
+						auto &workspace = m_workspaces[t];
+						const auto batch = _propagate_(workspace, std::next(begin, i), std::next(begin, std::min(last, i + batchSize)), "trainParallel", Parallel{ 1 });
+						_step_(workspace, learnRate, batch, steps + ((i - first) / batchSize + 1) * threads, Parallel{ 1 });
+					}
+				});
 
-			{
-				auto iterCon = m_connections.rbegin();
-				auto iterOut = output_errors.begin();
+				for (size_t t = 0; t < threads; ++t)
+				{
+					const auto first = size * t / threads, last = size * (t + 1) / threads;
+					m_steps += (last - first + batchSize - 1) / batchSize;
+				}
 
-				for (; std::distance(output_errors.begin(), iterOut) + 1 < static_cast<ptrdiff_t>(output_errors.capacity()); ++iterOut, ++iterCon)
-					output_errors.emplace_back((*iterCon)[0].transpose().dotProduct(*iterOut));
+				return *this;
 			}
 
-
-			//Calculate delta
+			for (size_t i = 0; i < size; i += batchSize)
 			{
-				auto iterErrOut = output_errors.begin();
-				auto iterNeuOut = neuronOutput.rbegin();
-				auto iterCon	= m_connections.rbegin();
+				const auto batch = std::min(batchSize, size - i);
+				const auto threads = std::min(par.count(batch * weights), batch);
+				if (threads <= 1)
+				{
+					trainBatch(std::next(begin, i), std::next(begin, i + batch), learnRate, par);
+					continue;
+				}
 
-				for (; iterCon != m_connections.rend(); ++iterErrOut, ++iterNeuOut, ++iterCon)
+				if (m_workspaces.size() < threads)
+					m_workspaces.resize(threads);
+
+				//Shards are fixed by index and summed in order, so results don't depend on scheduling
+				const auto first = std::next(begin, i);
+				ThreadPool::global().parallelFor(threads, [&](const size_t &t)
 				{
-					Matrix<double> biasDelta(*iterErrOut * learnRate * *iterNeuOut * (1. - *iterNeuOut));
-					Matrix<double> weightDelta(biasDelta.dotProduct((iterNeuOut + 1)->transpose()));
+					auto &workspace = m_workspaces[t];
+					_propagate_(workspace, std::next(first, batch * t / threads), std::next(first, batch * (t + 1) / threads), "trainParallel", Parallel{ 1 });
+					_gradient_(workspace, Parallel{ 1 });
+				});
+
+				auto &sum = m_workspaces.front().gradients;
+				for (size_t t = 1; t < threads; ++t)
+					for (size_t l = 0; l < sum.size(); ++l)
+					{
+						sum[l][0] += m_workspaces[t].gradients[l][0];
+						sum[l][1] += m_workspaces[t].gradients[l][1];
+					}
 
-					//Sum delta
-					(*iterCon)[0] += weightDelta;
-					(*iterCon)[1] += biasDelta;
-				}
+				_update_(sum, learnRate, batch, ++m_steps);
 			}
 
 			return *this;
@@ -120,24 +259,56 @@ namespace ctl
 
 			//Feedforward
 			Matrix<double> pred(d.begin(), d.end());
-			for (const auto& i : m_connections)
-				pred = (i[1] + i[0].dotProduct(pred)).apply(sigmoid);
+			for (size_t i = 0; i < m_connections.size(); ++i)
+			{
+				pred = m_connections[i][1] + m_connections[i][0].dotProduct(pred);
+				activate(m_activations[i], &pred.loc(0), 1, m_neurons[i + 1]);
+			}
 
 			return pred;
 		}
 
+		//Sum of squared errors over [begin, end), see evaluate
 		template<typename Iter, typename = typename std::enable_if_t<std::is_same_v<typename std::iterator_traits<Iter>::value_type, Data>>>
-		auto cost(Iter begin, const Iter &end) const
+		auto cost(Iter begin, const Iter &end, const Parallel &par = Parallel::global()) const
 		{
-			double cost = 0.;
-			for (; begin != end; ++begin)
+			return evaluate(begin, end, par).cost;
+		}
+
+		//Cost and accuracy of [begin, end). Threads of par take contiguous shards and feed them forward
+		//through buffers kept per thread, so after the first call no sample allocates.
+		//Shard sums are added in order, so results only depend on the thread count
+		template<typename Iter, typename = typename std::enable_if_t<std::is_same_v<typename std::iterator_traits<Iter>::value_type, Data>>>
+		Evaluation evaluate(Iter begin, const Iter &end, const Parallel &par = Parallel::global()) const
+		{
+			const auto size = size_t(std::distance(begin, end));
+			if (size == 0)
+				return Evaluation();
+			if (!_matchesNeurons_(m_neurons, m_connections))
+				throw Log("Neural Network: evaluate: Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			size_t weights = 0;
+			for (const auto &i : m_connections)
+				weights += i[0].dim().product();
+
+			const auto threads = std::min(par.count(size * weights), size);
+			if (threads <= 1)
+				return _evaluate_(begin, end);
+
+			std::vector<Evaluation> parts(threads);
+			ThreadPool::global().parallelFor(threads, [&](const size_t &t)
+			{
+				parts[t] = _evaluate_(std::next(begin, size * t / threads), std::next(begin, size * (t + 1) / threads));
+			});
+
+			Evaluation total;
+			for (const auto &i : parts)
 			{
-				const auto pred = query(begin->first);
-				for (size_t i = 0; i < m_neurons.back(); ++i)
-					cost += std::pow(pred(0, i) - begin->second[i], 2);
+				total.cost += i.cost;
+				total.correct += i.correct;
+				total.samples += i.samples;
 			}
-			
-			return cost;
+			return total;
 		}
 
 		auto& save(const std::string &fileName) const
@@ -190,10 +361,367 @@ namespace ctl
 			return *this;
 		}
 
+		//Writes the binary model format of NeuralNetFile.h, which keeps every bit and loads without parsing
+		auto& saveModel(const std::string &fileName) const
+		{
+			if (m_connections.empty())
+				throw Log("NeuralNet: saveModel: network has no connections.", Log::Severity::ERR0R);
+			if (!_matchesNeurons_(m_neurons, m_connections))
+				throw Log("NeuralNet: saveModel: connections are inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			const auto matrices = 2 * m_connections.size();
+			const auto words = m_neurons.size() + m_activations.size() + 2 * matrices;
+			const auto align = [](const uint64_t &x) { return (x + MatrixFileHeader::ALIGNMENT - 1) / MatrixFileHeader::ALIGNMENT * MatrixFileHeader::ALIGNMENT; };
+
+			//Neurons, activations then offset and checksum pairs
+			std::vector<uint64_t> table(m_neurons.begin(), m_neurons.end());
+			for (const auto &i : m_activations)
+				table.push_back(uint64_t(i));
+			uint64_t offset = align(sizeof(NeuralNetFileHeader) + words * 8);
+			for (const auto &conn : m_connections)
+				for (const auto &mat : conn)
+				{
+					table.push_back(offset);
+					table.push_back(_modelChecksum_(mat.data().data(), mat.data().size()));
+					offset = align(offset + mat.data().size() * sizeof(double));
+				}
+
+			NeuralNetFileHeader header;
+			header.layers = uint32_t(m_neurons.size());
+			header.tableChecksum = _modelChecksum_(table.data(), table.size());
+
+			std::ofstream file(fileName, std::ios::binary | std::ios::out | std::ios::trunc);
+			if (!file)
+				throw Log("NeuralNet: saveModel: file couldn't be created.", Log::Severity::ERR0R);
+
+			const char padding[MatrixFileHeader::ALIGNMENT] = {};
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(table.data()), table.size() * 8);
+
+			uint64_t at = sizeof(header) + words * 8;
+			for (size_t i = 0; i < matrices; ++i)
+			{
+				const auto &mat = m_connections[i / 2][i % 2];
+				const auto offset = table[m_neurons.size() + m_activations.size() + 2 * i];
+				file.write(padding, offset - at);
+				file.write(reinterpret_cast<const char*>(mat.data().data()), mat.data().size() * sizeof(double));
+				at = offset + mat.data().size() * sizeof(double);
+			}
+
+			if (!file)
+				throw Log("NeuralNet: saveModel: write failed.", Log::Severity::ERR0R);
+
+			return *this;
+		}
+
+		//Builds the network a saveModel file describes, no topology is needed beforehand.
+		//The file is mapped and each matrix copied once, files of the other byte order are swapped.
+		//verify checks every matrix's checksum, the table's always is
+		static NeuralNet loadModel(const std::string &fileName, const bool &verify = true)
+		{
+			MappedFile file(fileName);
+			const auto layout = _readModelLayout_(file.data(), file.size(), "loadModel");
+
+			NeuralNet net;
+			net.m_neurons = layout.neurons;
+			net.m_activations = layout.activations;
+			net.m_connections.resize(layout.neurons.size() - 1);
+
+			for (size_t i = 0; i < layout.matrices.size(); ++i)
+			{
+				auto &mat = net.m_connections[i / 2][i % 2];
+				mat = Matrix<double>(layout.dim(i), 0.);
+				std::memcpy(&mat.loc(0), static_cast<const char*>(file.data()) + layout.matrices[i][0], mat.dim().product() * sizeof(double));
+
+				if (layout.swap)
+					for (size_t j = 0; j < mat.dim().product(); ++j)
+						mat.loc(j) = _byteSwap_(mat.loc(j));
+
+				if (verify && _modelChecksum_(&mat.loc(0), mat.dim().product()) != layout.matrices[i][1])
+					throw Log("NeuralNetFile: loadModel: matrix checksum differs, file is corrupt.", Log::Severity::ERR0R);
+			}
+
+			return net;
+		}
+
 	private:
 		using Weight_Bias = std::array<Matrix<double>, 2>;
 
 		std::vector<Weight_Bias> m_connections;
+		//First and second moments of each connection, only those m_optimizer uses are kept
+		std::vector<std::array<Weight_Bias, 2>> m_moments;
+		Optimizer m_optimizer;
+		//Taken since the optimizer was set, for Adam's bias correction
+		size_t m_steps = 0;
 		std::vector<size_t> m_neurons;
+		//One per connection, applied to its outputs
+		std::vector<Activation> m_activations;
+
+		//evaluate on one thread. Samples go forward one at a time through two buffers kept per thread,
+		//each layer starting from its bias with the weight rows dotted into it
+		template<typename Iter>
+		Evaluation _evaluate_(Iter begin, const Iter &end) const
+		{
+			thread_local std::vector<double> buffers[2];
+			const auto widest = *std::max_element(m_neurons.begin(), m_neurons.end());
+			buffers[0].resize(widest);
+			buffers[1].resize(widest);
+
+			Evaluation result;
+			const auto outputs = m_neurons.back();
+			for (; begin != end; ++begin)
+			{
+				const auto &target = begin->second;
+				if (begin->first.size() != m_neurons.front() || target.size() != outputs)
+					throw Log("Neural Network: evaluate: Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+				const double *from = begin->first.data();
+				for (size_t i = 0; i < m_connections.size(); ++i)
+				{
+					auto *to = buffers[i % 2].data();
+					const auto &bias = m_connections[i][1].data();
+
+					std::copy(bias.begin(), bias.end(), to);
+					Simd::dotRows(&m_connections[i][0].loc(0), m_neurons[i], m_neurons[i + 1], from, m_neurons[i], to, 1);
+					activate(m_activations[i], to, 1, m_neurons[i + 1]);
+
+					from = to;
+				}
+
+				size_t predicted = 0, expected = 0;
+				for (size_t y = 0; y < outputs; ++y)
+				{
+					const auto error = from[y] - double(target[y]);
+					result.cost += error * error;
+
+					if (from[y] > from[predicted])
+						predicted = y;
+					if (target[y] && !target[expected])
+						expected = y;
+				}
+
+				//A single output is a yes or no
+				if (outputs == 1 ? (from[0] > 0.5) == target[0] : predicted == expected)
+					++result.correct;
+				++result.samples;
+			}
+
+			return result;
+		}
+
+		void _setActivations_(const std::initializer_list<Activation> &activations)
+		{
+			const auto layers = m_neurons.empty() ? 0 : m_neurons.size() - 1;
+			if (activations.size() != 0 && activations.size() != layers)
+				throw Log("Neural Network: constructor: need an activation per connection.", Log::Severity::ERR0R);
+
+			m_activations.assign(layers, Activation::SIGMOID);
+			std::copy(activations.begin(), activations.end(), m_activations.begin());
+		}
+
+		//Layer matrices of a batch, a column per sample, and the gradient summed over it
+		struct _Workspace_
+		{
+			std::vector<Matrix<double>> outputs;
+			std::vector<Matrix<double>> errors;
+			std::vector<Weight_Bias> gradients;
+		};
+
+		//Workspaces of trainBatch and the threads of trainParallel, reused between batches of the same size
+		std::vector<_Workspace_> m_workspaces;
+
+		//Feeds [begin, end) forward and back, leaving each layer's output and its error through the activation in w.
+		//Errors of a layer are found with the weights from before any step like in train. Returns the batch size
+		template<typename Iter>
+		size_t _propagate_(_Workspace_ &w, Iter begin, const Iter &end, const char *method, const Parallel &par) const
+		{
+			const auto batch = size_t(std::distance(begin, end));
+			if (batch == 0)
+				return 0;
+
+			w.outputs.resize(m_neurons.size());
+			w.errors.resize(m_neurons.size());
+			for (size_t i = 0; i < m_neurons.size(); ++i)
+				if (w.outputs[i].dim() != NumVec<size_t, 2>{ batch, m_neurons[i] })
+				{
+					w.outputs[i] = Matrix<double>({ batch, m_neurons[i] }, 0.);
+					w.errors[i] = Matrix<double>({ batch, m_neurons[i] }, 0.);
+				}
+
+			//Stack the inputs and set the output error to minus the targets
+			{
+				auto &input = w.outputs.front();
+				auto &error = w.errors.back();
+
+				size_t x = 0;
+				for (auto iter = begin; iter != end; ++iter, ++x)
+				{
+					if (iter->first.size() != m_neurons.front() || iter->second.size() != m_neurons.back())
+						throw Log(std::string("Neural Network: ") + method + ": Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+					for (size_t y = 0; y < m_neurons.front(); ++y)
+						input(x, y) = iter->first[y];
+					for (size_t y = 0; y < m_neurons.back(); ++y)
+						error(x, y) = -double(iter->second[y]);
+				}
+			}
+
+			//Feedforward, outputs = activation(weights x inputs + bias)
+			for (size_t i = 0; i < m_connections.size(); ++i)
+			{
+				auto &out = w.outputs[i + 1];
+				gemm(1., m_connections[i][0], w.outputs[i], 0., out, par);
+
+				for (size_t y = 0; y < out.dim()[1]; ++y)
+				{
+					const auto bias = m_connections[i][1].loc(y);
+					auto *row = &out.loc(y * batch);
+					for (size_t x = 0; x < batch; ++x)
+						row[x] += bias;
+				}
+
+				activate(m_activations[i], &out.loc(0), batch, out.dim()[1]);
+			}
+
+			//Error is output - target
+			w.errors.back() += w.outputs.back();
+
+			//Back propagate, then take each error through its activation
+			for (size_t i = m_connections.size(); i-- > 0;)
+			{
+				auto &error = w.errors[i + 1];
+				const auto &out = w.outputs[i + 1];
+
+				if (i > 0)
+					gemm(1., m_connections[i][0].t(), error, 0., w.errors[i], par);
+
+				derive(m_activations[i], &out.loc(0), &error.loc(0), batch, out.dim()[1]);
+			}
+
+			return batch;
+		}
+
+		//Steps the weights by rate times the gradient in w
+		void _descend_(const _Workspace_ &w, const double &rate, const Parallel &par)
+		{
+			for (size_t i = 0; i < m_connections.size(); ++i)
+			{
+				const auto &error = w.errors[i + 1];
+				gemm(-rate, error, w.outputs[i].t(), 1., m_connections[i][0], par);
+
+				auto &bias = m_connections[i][1];
+				for (size_t y = 0; y < bias.dim()[1]; ++y)
+					bias.loc(y) -= rate * _rowSum_(error, y);
+			}
+		}
+
+		//Step of the optimizer on the batch in w. SGD takes it straight from the errors, with the
+		//descent folded into the GEMM, the others go through the gradient
+		void _step_(_Workspace_ &w, const double &learnRate, const size_t &batch, const size_t &step, const Parallel &par)
+		{
+			if (m_optimizer.type == Optimizer::Type::SGD)
+				return _descend_(w, learnRate / batch, par);
+
+			_gradient_(w, par);
+			_update_(w.gradients, learnRate, batch, step);
+		}
+
+		//Moments of m_optimizer, zero for a new one or a changed topology
+		void _reserveMoments_()
+		{
+			const bool first = m_optimizer.type == Optimizer::Type::MOMENTUM || m_optimizer.type == Optimizer::Type::ADAM;
+			const bool second = m_optimizer.type == Optimizer::Type::RMSPROP || m_optimizer.type == Optimizer::Type::ADAM;
+
+			m_moments.resize(m_connections.size());
+			for (size_t i = 0; i < m_connections.size(); ++i)
+				for (size_t j = 0; j < 2; ++j)
+				{
+					auto &moment = m_moments[i][j];
+					const bool used = j == 0 ? first : second;
+					if (used && moment[0].dim() != m_connections[i][0].dim())
+						moment = { Matrix<double>(m_connections[i][0].dim(), 0.), Matrix<double>(m_connections[i][1].dim(), 0.) };
+				}
+		}
+
+		//Applies the gradient summed over batch samples in one fused pass per matrix, the step-th of the optimizer
+		void _update_(const std::vector<Weight_Bias> &gradients, const double &learnRate, const size_t &batch, const size_t &step)
+		{
+			_reserveMoments_();
+
+			//SGD and momentum are linear in the gradient, so the mean goes into the rate as in _descend_
+			Simd::StepCoefficients c{ learnRate / batch, 1, m_optimizer.decay1, m_optimizer.decay2, m_optimizer.epsilon };
+			if (m_optimizer.type == Optimizer::Type::RMSPROP || m_optimizer.type == Optimizer::Type::ADAM)
+			{
+				c.rate = learnRate;
+				c.scale = 1. / batch;
+			}
+			//Adam's m / (1 - beta1^t) over sqrt(v / (1 - beta2^t)) + epsilon
+			if (m_optimizer.type == Optimizer::Type::ADAM)
+			{
+				const auto correction = std::sqrt(1 - std::pow(m_optimizer.decay2, double(step)));
+				c.rate *= correction / (1 - std::pow(m_optimizer.decay1, double(step)));
+				c.epsilon *= correction;
+			}
+
+			for (size_t i = 0; i < m_connections.size(); ++i)
+				for (size_t j = 0; j < 2; ++j)
+				{
+					auto &weight = m_connections[i][j];
+					const auto n = weight.dim().product();
+					if (n == 0)
+						continue;
+
+					auto *w = &weight.loc(0);
+					const auto *g = &gradients[i][j].loc(0);
+					auto *m = m_moments[i][0][j].dim().product() == n ? &m_moments[i][0][j].loc(0) : nullptr;
+					auto *v = m_moments[i][1][j].dim().product() == n ? &m_moments[i][1][j].loc(0) : nullptr;
+
+					switch (m_optimizer.type)
+					{
+					case Optimizer::Type::SGD:
+						Simd::step<Simd::SgdStep>(c, w, g, m, v, n);
+						break;
+					case Optimizer::Type::MOMENTUM:
+						Simd::step<Simd::MomentumStep>(c, w, g, m, v, n);
+						break;
+					case Optimizer::Type::RMSPROP:
+						Simd::step<Simd::RmsPropStep>(c, w, g, m, v, n);
+						break;
+					case Optimizer::Type::ADAM:
+						Simd::step<Simd::AdamStep>(c, w, g, m, v, n);
+						break;
+					}
+				}
+		}
+
+		//Sums the gradient of w's batch into w.gradients
+		void _gradient_(_Workspace_ &w, const Parallel &par) const
+		{
+			w.gradients.resize(m_connections.size());
+			for (size_t i = 0; i < m_connections.size(); ++i)
+			{
+				auto &g = w.gradients[i];
+				if (g[0].dim() != m_connections[i][0].dim())
+				{
+					g[0] = Matrix<double>(m_connections[i][0].dim(), 0.);
+					g[1] = Matrix<double>(m_connections[i][1].dim(), 0.);
+				}
+
+				const auto &error = w.errors[i + 1];
+				gemm(1., error, w.outputs[i].t(), 0., g[0], par);
+
+				for (size_t y = 0; y < g[1].dim()[1]; ++y)
+					g[1].loc(y) = _rowSum_(error, y);
+			}
+		}
+
+		static double _rowSum_(const Matrix<double> &mat, const size_t &y)
+		{
+			const auto *row = &mat.loc(y * mat.dim()[0]);
+			double sum = 0;
+			for (size_t x = 0; x < mat.dim()[0]; ++x)
+				sum += row[x];
+			return sum;
+		}
 	};
 }
\ No newline at end of file
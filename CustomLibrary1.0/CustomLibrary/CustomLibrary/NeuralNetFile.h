@@ -0,0 +1,238 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+
+#include "MatrixFile.h"
+#include "Matrix.h"
+#include "Activation.h"
+#include "Error.h"
+
+//Binary NeuralNet models: a 64 byte header, a table of the layer sizes, activations and each matrix's offset and checksum,
+//then every weight and bias matrix row major on an aligned offset, in the order of NeuralNet::connections.
+//Checksums are of the values, so they hold for files of either byte order. Version 1 files have no
+//activations and load as all SIGMOID.
+
+namespace ctl
+{
+	struct NeuralNetFileHeader
+	{
+		static constexpr uint32_t VERSION = 2;
+
+		char magic[4] = { 'C', 'T', 'L', 'N' };
+		uint32_t version = VERSION;
+		uint32_t endian = MatrixFileHeader::ENDIAN;
+		MatrixFileType type = MatrixFileType::FLOAT64;
+		uint8_t elementSize = sizeof(double);
+		uint16_t reserved0 = 0;
+		uint32_t alignment = MatrixFileHeader::ALIGNMENT;
+		//Entries of the neuron table, matrices follow as a weight and a bias per connection
+		uint32_t layers = 0;
+		//Of the table, neurons, an activation per connection then an offset and checksum per matrix
+		uint64_t tableChecksum = 0;
+		uint8_t reserved1[32] = {};
+	};
+	static_assert(sizeof(NeuralNetFileHeader) == 64 && std::is_trivially_copyable_v<NeuralNetFileHeader>, "NeuralNetFile: header layout.");
+
+	//64 bit hash of count 8 byte words in four independent lanes, so it runs at memory speed
+	inline uint64_t _modelChecksum_(const void *data, const size_t &count)
+	{
+		constexpr uint64_t P1 = 0x9E3779B185EBCA87ull, P2 = 0xC2B2AE3D27D4EB4Full, P3 = 0x165667B19E3779F9ull;
+		const auto round = [](uint64_t h, const uint64_t &w)
+		{
+			h += w * P2;
+			return ((h << 31) | (h >> 33)) * P1;
+		};
+
+		const auto *bytes = static_cast<const unsigned char*>(data);
+		uint64_t lane[4] = { P1 + P2, P2, 0, 0 - P1 }, w;
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			for (size_t l = 0; l < 4; ++l)
+			{
+				std::memcpy(&w, bytes + (i + l) * 8, 8);
+				lane[l] = round(lane[l], w);
+			}
+		for (; i < count; ++i)
+		{
+			std::memcpy(&w, bytes + i * 8, 8);
+			lane[i % 4] = round(lane[i % 4], w);
+		}
+
+		uint64_t h = count * P3;
+		for (const auto &l : lane)
+			h = round(h ^ l, P3);
+
+		return h ^ (h >> 29);
+	}
+
+	//Where a model's matrices are in a file, read from its header and table
+	struct _ModelLayout_
+	{
+		std::vector<size_t> neurons;
+		std::vector<Activation> activations;
+		//Byte offset and checksum of each matrix, weights then bias of every connection
+		std::vector<std::array<uint64_t, 2>> matrices;
+		//Written on a machine of the other byte order
+		bool swap = false;
+
+		NumVec<size_t, 2> dim(const size_t &matrix) const
+		{
+			const auto layer = matrix / 2;
+			return { matrix % 2 == 0 ? neurons[layer] : 1, neurons[layer + 1] };
+		}
+	};
+
+	//Checks the header and table at the front of a size byte file
+	inline _ModelLayout_ _readModelLayout_(const void *file, const uint64_t &size, const char *method)
+	{
+		const std::string where = std::string("NeuralNetFile: ") + method + ": ";
+		const auto *bytes = static_cast<const char*>(file);
+
+		NeuralNetFileHeader header;
+		if (size < sizeof(header))
+			throw Log(where + "file is truncated.", Log::Severity::ERR0R);
+		std::memcpy(&header, bytes, sizeof(header));
+
+		if (std::memcmp(header.magic, "CTLN", 4) != 0)
+			throw Log(where + "not a model file.", Log::Severity::ERR0R);
+
+		_ModelLayout_ layout;
+		layout.swap = header.endian != MatrixFileHeader::ENDIAN;
+		if (layout.swap)
+		{
+			if (_byteSwap_(header.endian) != MatrixFileHeader::ENDIAN)
+				throw Log(where + "unknown byte order.", Log::Severity::ERR0R);
+
+			header.version = _byteSwap_(header.version);
+			header.layers = _byteSwap_(header.layers);
+			header.tableChecksum = _byteSwap_(header.tableChecksum);
+		}
+
+		if (header.version > NeuralNetFileHeader::VERSION)
+			throw Log(where + "newer file version.", Log::Severity::ERR0R);
+		if (header.type != MatrixFileType::FLOAT64 || header.elementSize != sizeof(double))
+			throw Log(where + "element type differs.", Log::Severity::ERR0R);
+		if (header.layers < 2)
+			throw Log(where + "model has no connections.", Log::Severity::ERR0R);
+
+		//Neurons, activations from version 2 and offset and checksum pairs, all 8 byte words
+		const uint64_t connections = uint64_t(header.layers) - 1, matrices = 2 * connections;
+		const uint64_t activations = header.version >= 2 ? connections : 0, words = header.layers + activations + 2 * matrices;
+		if ((size - sizeof(header)) / 8 < words)
+			throw Log(where + "file is truncated.", Log::Severity::ERR0R);
+
+		std::vector<uint64_t> table(words);
+		std::memcpy(table.data(), bytes + sizeof(header), words * 8);
+		if (layout.swap)
+			for (auto &i : table)
+				i = _byteSwap_(i);
+
+		if (_modelChecksum_(table.data(), words) != header.tableChecksum)
+			throw Log(where + "table checksum differs, file is corrupt.", Log::Severity::ERR0R);
+
+		//The checksum only catches damage, a crafted table could wrap the sizes below the file size.
+		//A layer can't have more neurons than the file has values, or none
+		for (size_t i = 0; i < header.layers; ++i)
+		{
+			if (table[i] == 0)
+				throw Log(where + "layer has no neurons.", Log::Severity::ERR0R);
+			if (table[i] > size / sizeof(double))
+				throw Log(where + "layer is larger than the file.", Log::Severity::ERR0R);
+		}
+		layout.neurons.assign(table.begin(), table.begin() + header.layers);
+		layout.activations.assign(connections, Activation::SIGMOID);
+		for (size_t i = 0; i < activations; ++i)
+		{
+			if (table[header.layers + i] > uint64_t(Activation::SOFTMAX))
+				throw Log(where + "unknown activation.", Log::Severity::ERR0R);
+			layout.activations[i] = Activation(table[header.layers + i]);
+		}
+
+		const auto pairs = table.begin() + header.layers + activations;
+		layout.matrices.resize(matrices);
+		for (size_t i = 0; i < matrices; ++i)
+		{
+			layout.matrices[i] = { pairs[2 * i], pairs[2 * i + 1] };
+
+			//Compared by division so the product can't wrap
+			const auto offset = layout.matrices[i][0];
+			const auto dim = layout.dim(i);
+			if (offset % alignof(double) != 0 || offset < sizeof(header) + words * 8 || offset > size || (dim[1] != 0 && (size - offset) / sizeof(double) / dim[1] < dim[0]))
+				throw Log(where + "file is truncated.", Log::Severity::ERR0R);
+		}
+
+		return layout;
+	}
+
+	//Read only model mapped from a file, weights are used from the file's pages without being copied.
+	//Copies share the mapping, which lives until the last one is gone
+	class MappedNeuralNet
+	{
+	public:
+		using View = MatrixView<const double>;
+
+		//verify reads every page to check the matrices' checksums, without it only the table is checked
+		MappedNeuralNet(const std::string &path, const bool &verify = false)
+			: m_file(std::make_shared<MappedFile>(path))
+		{
+			const auto layout = _readModelLayout_(m_file->data(), m_file->size(), "mapModel");
+			if (layout.swap)
+				throw Log("NeuralNetFile: mapModel: byte order differs, use NeuralNet::loadModel.", Log::Severity::ERR0R);
+
+			m_neurons = layout.neurons;
+			m_activations = layout.activations;
+			m_connections.reserve(m_neurons.size() - 1);
+
+			for (size_t i = 0; i < layout.matrices.size(); i += 2)
+			{
+				std::array<View, 2> conn = { _view_(layout, i), _view_(layout, i + 1) };
+				if (verify)
+					for (size_t j = 0; j < 2; ++j)
+						if (_modelChecksum_(conn[j].ptr(), conn[j].dim().product()) != layout.matrices[i + j][1])
+							throw Log("NeuralNetFile: mapModel: matrix checksum differs, file is corrupt.", Log::Severity::ERR0R);
+
+				m_connections.push_back(conn);
+			}
+		}
+
+		const auto& neurons() const { return m_neurons; }
+		const auto& activations() const { return m_activations; }
+		//Weight and bias views, valid while this or a copy of it exists
+		const auto& connections() const { return m_connections; }
+
+		auto query(const std::vector<double> &d) const
+		{
+			if (d.size() != m_neurons.front())
+				throw Log("MappedNeuralNet: query: Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			Matrix<double> pred(d.begin(), d.end());
+			for (size_t i = 0; i < m_connections.size(); ++i)
+			{
+				pred = m_connections[i][1] + m_connections[i][0].dotProduct(pred);
+				activate(m_activations[i], &pred.loc(0), 1, m_neurons[i + 1]);
+			}
+
+			return pred;
+		}
+
+	private:
+		View _view_(const _ModelLayout_ &layout, const size_t &matrix) const
+		{
+			const auto dim = layout.dim(matrix);
+			return View(reinterpret_cast<const double*>(static_cast<const char*>(m_file->data()) + layout.matrices[matrix][0]), dim, { 1, dim[0] });
+		}
+
+		std::shared_ptr<MappedFile> m_file;
+		std::vector<size_t> m_neurons;
+		std::vector<Activation> m_activations;
+		std::vector<std::array<View, 2>> m_connections;
+	};
+
+	inline MappedNeuralNet mapModel(const std::string &path, const bool &verify = false) { return MappedNeuralNet(path, verify); }
+}
\ No newline at end of file
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "NeuralNet.h"
+#include "NeuralNetFile.h"
+#include "Activation.h"
+#include "Simd.h"
+#include "Error.h"
+
+//Inference on int8 weights, an eighth the size of the double ones. Each layer's input is rounded to int8
+//with one scale and its weights with a scale per layer or per row, their products sum exactly in int32
+//and are scaled back to double for the bias and activation. Queries don't allocate.
+
+namespace ctl
+{
+	//What shares a weight scale. PER_ROW keeps a neuron of small weights from losing its bits to a large one elsewhere
+	enum class Quantization { PER_LAYER, PER_ROW };
+
+	class QuantizedNeuralNet
+	{
+	public:
+		//Widest layer input whose int32 sums can't overflow, see Simd::dotI8
+		static constexpr size_t MAX_INPUTS = 133144;
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		QuantizedNeuralNet() = default;
+		//Copies share the weights and get their own buffers, make one per serving thread
+		QuantizedNeuralNet(const QuantizedNeuralNet &) = default;
+		QuantizedNeuralNet(QuantizedNeuralNet &&) = default;
+
+		//Rounds a trained NeuralNet or MappedNeuralNet, weights scale so their largest magnitude maps to 127
+		template<typename Net, typename = typename std::enable_if_t<std::is_same_v<Net, NeuralNet> || std::is_same_v<Net, MappedNeuralNet>>>
+		explicit QuantizedNeuralNet(const Net &net, const Quantization &quantization = Quantization::PER_ROW)
+			: m_neurons(net.neurons())
+			, m_activations(net.activations())
+			, m_quantization(quantization)
+		{
+			if (m_neurons.size() < 2)
+				throw Log("QuantizedNeuralNet: constructor: network has no connections.", Log::Severity::ERR0R);
+			if (!_matchesNeurons_(m_neurons, net.connections()))
+				throw Log("QuantizedNeuralNet: constructor: connections are inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			auto weights = std::make_shared<_Weights_>();
+			for (size_t i = 0; i + 1 < m_neurons.size(); ++i)
+			{
+				const auto k = m_neurons[i], m = m_neurons[i + 1];
+				if (k > MAX_INPUTS)
+					throw Log("QuantizedNeuralNet: constructor: layer is too wide for int32 sums.", Log::Severity::ERR0R);
+
+				m_offsets.push_back({ weights->values.size(), weights->scales.size() });
+
+				const auto &conn = net.connections()[i];
+				const auto largest = [&conn, &k](const size_t &begin, const size_t &end)
+				{
+					double result = 0;
+					for (size_t y = begin; y < end; ++y)
+						for (size_t x = 0; x < k; ++x)
+							result = std::max(result, std::fabs(double(conn[0](x, y))));
+					return result;
+				};
+
+				const auto layer = largest(0, m);
+				for (size_t y = 0; y < m; ++y)
+				{
+					const auto range = quantization == Quantization::PER_ROW ? largest(y, y + 1) : layer;
+					const double scale = range > 0 ? range / 127 : 1;
+
+					for (size_t x = 0; x < k; ++x)
+						weights->values.push_back(Simd::I8::encode(float(conn[0](x, y) / scale)));
+					weights->scales.push_back(float(scale));
+					weights->biases.push_back(float(conn[1](0, y)));
+				}
+			}
+			m_weights = std::move(weights);
+
+			const auto widest = *std::max_element(m_neurons.begin(), m_neurons.end());
+			m_input.resize(widest);
+			m_sums.resize(widest);
+			m_output.resize(widest);
+		}
+
+		//---------------------------------------------------------
+		//----------------------Operators--------------------------
+		//---------------------------------------------------------
+
+		QuantizedNeuralNet& operator=(const QuantizedNeuralNet &) = default;
+		QuantizedNeuralNet& operator=(QuantizedNeuralNet &&) = default;
+
+		const auto& neurons() const { return m_neurons; }
+		const auto& quantization() const { return m_quantization; }
+		size_t inputs() const { return m_neurons.empty() ? 0 : m_neurons.front(); }
+		size_t outputs() const { return m_neurons.empty() ? 0 : m_neurons.back(); }
+
+		//Bytes of weights, scales and biases
+		size_t bytes() const
+		{
+			if (!m_weights)
+				return 0;
+			return m_weights->values.size() + (m_weights->scales.size() + m_weights->biases.size()) * sizeof(float);
+		}
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//Feeds inputs() values forward, returns outputs() values that stay valid until the next query.
+		//A layer's input is rounded before its output is written, so one buffer serves every layer
+		const double* query(const double *input)
+		{
+			const double *from = input;
+			for (size_t i = 0; i < m_offsets.size(); ++i)
+			{
+				const auto k = m_neurons[i], m = m_neurons[i + 1];
+				const auto *values = m_weights->values.data() + m_offsets[i][0];
+				const auto *scales = m_weights->scales.data() + m_offsets[i][1], *biases = m_weights->biases.data() + m_offsets[i][1];
+
+				const auto largest = Simd::reduce<Simd::Max, Simd::Abs>(from, k);
+				const double scale = largest > 0 ? largest / 127 : 1, inverse = 1 / scale;
+				for (size_t x = 0; x < k; ++x)
+					m_input[x] = Simd::I8::encode(float(from[x] * inverse));
+
+				Simd::dotI8(values, k, m, m_input.data(), k, m_sums.data());
+
+				auto *to = m_output.data();
+				for (size_t y = 0; y < m; ++y)
+					to[y] = biases[y] + scale * scales[y] * m_sums[y];
+				activate(m_activations[i], to, 1, m);
+
+				from = to;
+			}
+
+			return from;
+		}
+
+		const double* query(const std::vector<double> &input)
+		{
+			if (input.size() != inputs())
+				throw Log("QuantizedNeuralNet: query: Data is inconsistant with amount of neurons.", Log::Severity::ERR0R);
+
+			return query(input.data());
+		}
+
+		//Writes outputs() values to output
+		void query(const double *input, double *output)
+		{
+			const auto *result = query(input);
+			std::copy(result, result + outputs(), output);
+		}
+
+	private:
+		//Rows of every layer back to back, with a scale and bias per row
+		struct _Weights_
+		{
+			std::vector<int8_t> values;
+			std::vector<float> scales;
+			std::vector<float> biases;
+		};
+
+		std::vector<size_t> m_neurons;
+		std::vector<Activation> m_activations;
+		Quantization m_quantization = Quantization::PER_ROW;
+		//Value and row offsets of each connection into m_weights
+		std::vector<NumVec<size_t, 2>> m_offsets;
+		std::shared_ptr<const _Weights_> m_weights;
+
+		std::vector<int8_t> m_input;
+		std::vector<int32_t> m_sums;
+		std::vector<double> m_output;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,444 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "Matrix.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Error.h"
+
+//Whole matrix, per row and per column reductions of a Matrix, view or expression.
+//Expressions and views whose rows aren't laid out as a Matrix's are evaluated first.
+//Min and max follow the instructions on NaNs, so a NaN gives an unspecified result.
+
+namespace ctl
+{
+	//FAST sums in all the lanes the instruction set has and splits the work by thread, so the last
+	//bits may change with the thread count or the CPU. ORDERED sums fixed blocks in fixed lanes and
+	//adds the blocks in order, giving the same bits for any thread count or instruction set
+	enum class Summation { FAST, ORDERED };
+
+	//Elements per block of an ORDERED sum, a multiple of the lanes
+	constexpr size_t REDUCTION_BLOCK = 8192;
+
+	//Calls func(ptr, rowStride) with the elements of row y at ptr + y * rowStride
+	template<typename M, typename F>
+	auto _withRows_(const M &mat, F &&func)
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		if constexpr (_is_matrix_<M>)
+			return func(mat.data().data(), mat.dim()[0]);
+		else if constexpr (_is_matrix_view_<M>)
+		{
+			if (mat.stride()[0] == 1)
+				return func(static_cast<const Type*>(mat.ptr() + mat.offset()), mat.stride()[1]);
+
+			const Matrix<Type> eval(mat);
+			return func(eval.data().data(), eval.dim()[0]);
+		}
+		else
+		{
+			const Matrix<Type> eval(mat);
+			return func(eval.data().data(), eval.dim()[0]);
+		}
+	}
+
+	//Calls func(ptr) with all the elements row major and adjacent
+	template<typename M, typename F>
+	auto _withContiguous_(const M &mat, F &&func)
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		return _withRows_(mat, [&mat, &func](const Type *p, const size_t &row)
+		{
+			if (row == mat.dim()[0] || mat.dim()[1] == 1)
+				return func(p);
+
+			const Matrix<Type> eval(mat);
+			return func(eval.data().data());
+		});
+	}
+
+	//ORDERED sum of one range, blocks added in order
+	template<typename Map, typename Type>
+	Type _sumBlocks_(const Type *p, const size_t &n)
+	{
+		Type sum = Simd::sumOrdered<Map>(p, std::min(n, REDUCTION_BLOCK));
+		for (size_t i = REDUCTION_BLOCK; i < n; i += REDUCTION_BLOCK)
+			sum += Simd::sumOrdered<Map>(p + i, std::min(REDUCTION_BLOCK, n - i));
+		return sum;
+	}
+
+	//Op over Map of n adjacent elements, n > 0 unless Op is Add
+	template<typename Op, typename Map, typename Type>
+	Type _reduceAll_(const Type *p, const size_t &n, const Summation &mode, const Parallel &par)
+	{
+		if constexpr (std::is_same_v<Op, Simd::Add>)
+			if (mode == Summation::ORDERED)
+			{
+				const auto blocks = (n + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK;
+				const auto threads = std::min(par.count(n), blocks);
+				if (threads <= 1)
+					return _sumBlocks_<Map>(p, n);
+
+				std::vector<Type> partial(blocks);
+				ThreadPool::global().parallelRange(blocks, threads, [p, n, &partial](const size_t &begin, const size_t &end)
+				{
+					for (size_t i = begin; i < end; ++i)
+						partial[i] = Simd::sumOrdered<Map>(p + i * REDUCTION_BLOCK, std::min(REDUCTION_BLOCK, n - i * REDUCTION_BLOCK));
+				});
+
+				Type sum = partial[0];
+				for (size_t i = 1; i < blocks; ++i)
+					sum += partial[i];
+				return sum;
+			}
+
+		const auto threads = std::min(par.count(n), n);
+		if (threads <= 1)
+			return Simd::reduce<Op, Map>(p, n);
+
+		std::vector<Type> partial(threads);
+		ThreadPool::global().parallelFor(threads, [p, n, threads, &partial](const size_t &i)
+		{
+			const auto begin = n * i / threads, end = n * (i + 1) / threads;
+			partial[i] = Simd::reduce<Op, Map>(p + begin, end - begin);
+		});
+
+		Type result = partial[0];
+		for (size_t i = 1; i < threads; ++i)
+			result = Op::apply(result, partial[i]);
+		return result;
+	}
+
+	//Op over Map of each row into a height x 1 column
+	template<typename Op, typename Map, typename M>
+	auto _reduceRows_(const M &mat, const Summation &mode, const Parallel &par, const char *method)
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto w = mat.dim()[0], h = mat.dim()[1];
+		if (!std::is_same_v<Op, Simd::Add> && w == 0 && h != 0)
+			throw Log(std::string("Reduction: ") + method + ": matrix is empty.", Log::Severity::ERR0R);
+
+		Matrix<Type> result({ size_t(1), h }, 0);
+		if (w * h == 0)
+			return result;
+
+		auto *to = &result.loc(0);
+		_withRows_(mat, [w, h, &mode, &par, to](const Type *p, const size_t &row)
+		{
+			const auto rows = [w, &mode, to, p, row](const size_t &begin, const size_t &end)
+			{
+				for (size_t y = begin; y < end; ++y)
+					to[y] = std::is_same_v<Op, Simd::Add> && mode == Summation::ORDERED ? _sumBlocks_<Map>(p + y * row, w) : Simd::reduce<Op, Map>(p + y * row, w);
+			};
+
+			const auto threads = std::min(par.count(w * h), h);
+			if (threads <= 1)
+				return rows(0, h);
+
+			ThreadPool::global().parallelRange(h, threads, rows);
+		});
+
+		return result;
+	}
+
+	//Op over Map of each column into a 1 x width row. Each column is reduced top to bottom,
+	//so sums are the same whatever the thread count or instruction set
+	template<typename Op, typename Map, typename M>
+	auto _reduceCols_(const M &mat, const Parallel &par, const char *method)
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+		static_assert(std::is_same_v<Map, Simd::Identity> || std::is_same_v<Map, Simd::Square>, "Reduction: columns only map to themselves or their square.");
+
+		const auto w = mat.dim()[0], h = mat.dim()[1];
+		if (!std::is_same_v<Op, Simd::Add> && h == 0 && w != 0)
+			throw Log(std::string("Reduction: ") + method + ": matrix is empty.", Log::Severity::ERR0R);
+
+		Matrix<Type> result({ w, size_t(1) }, 0);
+		if (w * h == 0)
+			return result;
+
+		auto *to = &result.loc(0);
+		_withRows_(mat, [w, h, &par, to](const Type *p, const size_t &row)
+		{
+			const auto cols = [h, to, p, row](const size_t &begin, const size_t &end)
+			{
+				const auto n = end - begin;
+				auto *out = to + begin;
+
+				thread_local std::vector<Type> squared;
+				if constexpr (std::is_same_v<Map, Simd::Square>)
+					squared.resize(n);
+
+				for (size_t y = 0; y < h; ++y)
+				{
+					const Type *in = p + y * row + begin;
+					if constexpr (std::is_same_v<Map, Simd::Square>)
+					{
+						Simd::arith<Simd::Mul>(in, in, squared.data(), n);
+						in = squared.data();
+					}
+
+					if (y == 0)
+						std::copy(in, in + n, out);
+					else
+						Simd::arith<Op>(out, in, out, n);
+				}
+			};
+
+			//Ranges are whole cache lines of the result
+			constexpr size_t LINE = std::max(size_t(1), CACHE_LINE / sizeof(Type));
+			const auto threads = std::min(par.count(w * h), (w + LINE - 1) / LINE);
+			if (threads <= 1)
+				return cols(0, w);
+
+			ThreadPool::global().parallelFor(threads, [w, threads, &cols](const size_t &i)
+			{
+				const auto lines = (w + LINE - 1) / LINE;
+				cols(std::min(w, lines * i / threads * LINE), std::min(w, lines * (i + 1) / threads * LINE));
+			});
+		});
+
+		return result;
+	}
+
+	//-------------------------------------------------------------------------------
+	//-------------------------------Whole Matrix------------------------------------
+	//-------------------------------------------------------------------------------
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto sum(const M &mat, const Summation &mode = Summation::FAST, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			return Type(0);
+
+		return _withContiguous_(mat, [n, &mode, &par](const Type *p) { return _reduceAll_<Simd::Add, Simd::Identity>(p, n, mode, par); });
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto minimum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			throw Log("Reduction: minimum: matrix is empty.", Log::Severity::ERR0R);
+
+		return _withContiguous_(mat, [n, &par](const Type *p) { return _reduceAll_<Simd::Min, Simd::Identity>(p, n, Summation::FAST, par); });
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto maximum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			throw Log("Reduction: maximum: matrix is empty.", Log::Severity::ERR0R);
+
+		return _withContiguous_(mat, [n, &par](const Type *p) { return _reduceAll_<Simd::Max, Simd::Identity>(p, n, Summation::FAST, par); });
+	}
+
+	//{ x, y } of the first smallest element in row major order
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	NumVec<size_t, 2> argmin(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			throw Log("Reduction: argmin: matrix is empty.", Log::Severity::ERR0R);
+
+		const auto i = _withContiguous_(mat, [n, &par](const Type *p)
+		{
+			const auto best = _reduceAll_<Simd::Min, Simd::Identity>(p, n, Summation::FAST, par);
+			return size_t(std::find(p, p + n, best) - p) % n;
+		});
+		return { i % mat.dim()[0], i / mat.dim()[0] };
+	}
+
+	//{ x, y } of the first largest element in row major order
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	NumVec<size_t, 2> argmax(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			throw Log("Reduction: argmax: matrix is empty.", Log::Severity::ERR0R);
+
+		const auto i = _withContiguous_(mat, [n, &par](const Type *p)
+		{
+			const auto best = _reduceAll_<Simd::Max, Simd::Identity>(p, n, Summation::FAST, par);
+			return size_t(std::find(p, p + n, best) - p) % n;
+		});
+		return { i % mat.dim()[0], i / mat.dim()[0] };
+	}
+
+	//Sum of magnitudes
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto norm1(const M &mat, const Summation &mode = Summation::FAST, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+		static_assert(std::is_floating_point_v<Type>, "Reduction: norm1: type must be floating point.");
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			return Type(0);
+
+		return _withContiguous_(mat, [n, &mode, &par](const Type *p) { return _reduceAll_<Simd::Add, Simd::Abs>(p, n, mode, par); });
+	}
+
+	//Euclidean norm of all the elements, Frobenius for a matrix
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto norm2(const M &mat, const Summation &mode = Summation::FAST, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+		static_assert(std::is_floating_point_v<Type>, "Reduction: norm2: type must be floating point.");
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			return Type(0);
+
+		return std::sqrt(_withContiguous_(mat, [n, &mode, &par](const Type *p) { return _reduceAll_<Simd::Add, Simd::Square>(p, n, mode, par); }));
+	}
+
+	//Largest magnitude
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto normInf(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+		static_assert(std::is_floating_point_v<Type>, "Reduction: normInf: type must be floating point.");
+
+		const auto n = mat.dim().product();
+		if (n == 0)
+			return Type(0);
+
+		return _withContiguous_(mat, [n, &par](const Type *p) { return _reduceAll_<Simd::Max, Simd::Abs>(p, n, Summation::FAST, par); });
+	}
+
+	//-------------------------------------------------------------------------------
+	//----------------------------------Rows-----------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//Each returns a height x 1 column, or a vector of x positions
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto rowSum(const M &mat, const Summation &mode = Summation::FAST, const Parallel &par = Parallel::global())
+	{
+		return _reduceRows_<Simd::Add, Simd::Identity>(mat, mode, par, "rowSum");
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto rowMinimum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		return _reduceRows_<Simd::Min, Simd::Identity>(mat, Summation::FAST, par, "rowMinimum");
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto rowMaximum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		return _reduceRows_<Simd::Max, Simd::Identity>(mat, Summation::FAST, par, "rowMaximum");
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto rowNorm2(const M &mat, const Summation &mode = Summation::FAST, const Parallel &par = Parallel::global())
+	{
+		static_assert(std::is_floating_point_v<typename std::decay_t<M>::value_type>, "Reduction: rowNorm2: type must be floating point.");
+
+		auto result = _reduceRows_<Simd::Add, Simd::Square>(mat, mode, par, "rowNorm2");
+		for (size_t i = 0; i < result.dim()[1]; ++i)
+			result.loc(i) = std::sqrt(result.loc(i));
+		return result;
+	}
+
+	//First largest element of each row
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	std::vector<size_t> rowArgmax(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto w = mat.dim()[0], h = mat.dim()[1];
+		const auto best = rowMaximum(mat, par);
+		std::vector<size_t> result(h, 0);
+		if (w * h == 0)
+			return result;
+
+		_withRows_(mat, [w, h, &best, &result](const Type *p, const size_t &row)
+		{
+			for (size_t y = 0; y < h; ++y)
+				result[y] = size_t(std::find(p + y * row, p + y * row + w, best.loc(y)) - (p + y * row)) % w;
+		});
+
+		return result;
+	}
+
+	//-------------------------------------------------------------------------------
+	//--------------------------------Columns----------------------------------------
+	//-------------------------------------------------------------------------------
+
+	//Each returns a 1 x width row, or a vector of y positions.
+	//Columns sum top to bottom, the same bits in either Summation mode
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto colSum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		return _reduceCols_<Simd::Add, Simd::Identity>(mat, par, "colSum");
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto colMinimum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		return _reduceCols_<Simd::Min, Simd::Identity>(mat, par, "colMinimum");
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto colMaximum(const M &mat, const Parallel &par = Parallel::global())
+	{
+		return _reduceCols_<Simd::Max, Simd::Identity>(mat, par, "colMaximum");
+	}
+
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	auto colNorm2(const M &mat, const Parallel &par = Parallel::global())
+	{
+		static_assert(std::is_floating_point_v<typename std::decay_t<M>::value_type>, "Reduction: colNorm2: type must be floating point.");
+
+		auto result = _reduceCols_<Simd::Add, Simd::Square>(mat, par, "colNorm2");
+		for (size_t i = 0; i < result.dim()[0]; ++i)
+			result.loc(i) = std::sqrt(result.loc(i));
+		return result;
+	}
+
+	//First largest element of each column, e.g. the class of each sample in a batch of network outputs
+	template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+	std::vector<size_t> colArgmax(const M &mat, const Parallel &par = Parallel::global())
+	{
+		using Type = std::remove_const_t<typename std::decay_t<M>::value_type>;
+
+		const auto w = mat.dim()[0], h = mat.dim()[1];
+		const auto best = colMaximum(mat, par);
+		std::vector<size_t> result(w, 0);
+		if (w * h == 0)
+			return result;
+
+		//Rows are scanned bottom up so the topmost match is kept
+		_withRows_(mat, [w, h, &best, &result](const Type *p, const size_t &row)
+		{
+			for (size_t y = h; y-- > 0;)
+				for (size_t x = 0; x < w; ++x)
+					if (p[y * row + x] == best.loc(x))
+						result[x] = y;
+		});
+
+		return result;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,1407 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CTL_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+#endif // x86
+
+//GCC and Clang only emit AVX2 inside functions marked for it, MSVC emits it anywhere.
+//The AVX2 level also takes F16C for half precision conversion, every AVX2 CPU has it
+#if defined(CTL_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CTL_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#else
+#define CTL_TARGET_AVX2
+#endif
+
+namespace ctl
+{
+	namespace Simd
+	{
+		enum class Level { SCALAR, SSE2, AVX2 };
+
+		//-------------------------------------------------------------------------------
+		//-----------------------------CPU Detection-------------------------------------
+		//-------------------------------------------------------------------------------
+
+		inline Level _detect_()
+		{
+#ifdef CTL_SIMD_X86
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] >= 7)
+			{
+				__cpuid(info, 1);
+				const bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (info[2] & (1 << 29)) && (_xgetbv(0) & 6) == 6;
+
+				__cpuidex(info, 7, 0);
+				if (osAvx && (info[1] & (1 << 5)))
+					return Level::AVX2;
+			}
+			return Level::SSE2;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c") ? Level::AVX2 : Level::SSE2;
+#endif // _MSC_VER
+#else
+			return Level::SCALAR;
+#endif // CTL_SIMD_X86
+		}
+
+		inline Level& _level_()
+		{
+			static Level level = _detect_();
+			return level;
+		}
+
+		//Instruction set used by the kernels
+		inline Level level() { return _level_(); }
+
+		//Cap the instruction set, for benchmarking the fallbacks. Can't raise it past what the CPU has.
+		inline void setLevel(const Level &l) { _level_() = std::min(l, _detect_()); }
+
+		//-------------------------------------------------------------------------------
+		//-------------------------------Operations--------------------------------------
+		//-------------------------------------------------------------------------------
+
+		struct Add { template<typename T> static constexpr T apply(const T &a, const T &b) { return a + b; } };
+		struct Sub { template<typename T> static constexpr T apply(const T &a, const T &b) { return a - b; } };
+		struct Mul { template<typename T> static constexpr T apply(const T &a, const T &b) { return a * b; } };
+		struct Div { template<typename T> static constexpr T apply(const T &a, const T &b) { return a / b; } };
+		//Same operand order as the min and max instructions, b is returned on ties and NaNs
+		struct Min { template<typename T> static constexpr T apply(const T &a, const T &b) { return a < b ? a : b; } };
+		struct Max { template<typename T> static constexpr T apply(const T &a, const T &b) { return a > b ? a : b; } };
+
+		//Applied to each element before a reduction
+		struct Identity { template<typename T> static constexpr T apply(const T &x) { return x; } };
+		struct Abs { template<typename T> static T apply(const T &x) { return T(std::abs(x)); } };
+		struct Square { template<typename T> static constexpr T apply(const T &x) { return x * x; } };
+		struct Sqrt { template<typename T> static T apply(const T &x) { return T(std::sqrt(x)); } };
+
+		//-------------------------------------------------------------------------------
+		//----------------------------Reduced Precision----------------------------------
+		//-------------------------------------------------------------------------------
+
+		//Storage formats that are widened to float for arithmetic.
+		//encode rounds to nearest even, like the hardware conversions
+
+		//IEEE 754 binary16
+		struct F16
+		{
+			using storage = uint16_t;
+
+			static float decode(const storage &h)
+			{
+				const uint32_t sign = uint32_t(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+
+				if (exp == 0)
+				{
+					//Zero or subnormal, mant * 2^-24
+					const float f = float(mant) * 5.9604645e-8f;
+					return sign ? -f : f;
+				}
+
+				const uint32_t bits = sign | (exp == 31 ? 0x7f800000 | (mant << 13) : ((exp + 112) << 23) | (mant << 13));
+				float f;
+				std::memcpy(&f, &bits, sizeof(f));
+				return f;
+			}
+
+			static storage encode(const float &f)
+			{
+				uint32_t x;
+				std::memcpy(&x, &f, sizeof(x));
+				const auto sign = storage((x >> 16) & 0x8000);
+				x &= 0x7fffffff;
+
+				//Inf and NaN, NaNs stay quiet
+				if (x >= 0x7f800000)
+					return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+				//Rounds up past 65504
+				if (x >= 0x477ff000)
+					return sign | 0x7c00;
+				//Subnormal, counted in steps of 2^-24. 0x400 is the smallest normal
+				if (x < 0x38800000)
+					return sign | storage(std::nearbyint(std::fabs(f) * 16777216.f));
+
+				//Rebias the exponent from 127 to 15 and round the 13 dropped bits, a carry moves into the exponent
+				x += 0xc8000fff + ((x >> 13) & 1);
+				return sign | storage(x >> 13);
+			}
+		};
+
+		//Top half of a float, same range with 8 bits of mantissa
+		struct BF16
+		{
+			using storage = uint16_t;
+
+			static float decode(const storage &h)
+			{
+				const uint32_t bits = uint32_t(h) << 16;
+				float f;
+				std::memcpy(&f, &bits, sizeof(f));
+				return f;
+			}
+
+			static storage encode(const float &f)
+			{
+				uint32_t x;
+				std::memcpy(&x, &f, sizeof(x));
+
+				if ((x & 0x7fffffff) > 0x7f800000)
+					return storage((x >> 16) | 0x40);
+
+				return storage((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+			}
+		};
+
+		//Symmetric 8 bit integer, scaled by the owner
+		struct I8
+		{
+			using storage = int8_t;
+
+			static float decode(const storage &q) { return float(q); }
+			static storage encode(const float &f) { return storage(std::clamp(std::nearbyint(f), -127.f, 127.f)); }
+		};
+
+		//Ordered sums keep ORDERED_LANES lanes, lane j takes the elements with i % ORDERED_LANES == j.
+		//Any register width splits the lanes the same way, so every instruction set gives the same bits
+		constexpr size_t ORDERED_LANES = 8;
+
+		template<typename Map, typename Type>
+		Type _orderedTail_(Type *lanes, const Type *a, size_t i, const size_t &n)
+		{
+			for (; i < n; ++i)
+				lanes[i % ORDERED_LANES] += Map::apply(a[i]);
+
+			Type sum = lanes[0];
+			for (size_t j = 1; j < ORDERED_LANES; ++j)
+				sum += lanes[j];
+			return sum;
+		}
+
+		//Entry by entry, each element sums its products in order like a naive loop
+		template<typename Type>
+		void _batchScalar_(const Type *a, const Type *b, Type *c, const size_t &m, const size_t &n, const size_t &k, const size_t &count)
+		{
+			for (size_t e = 0; e < count; ++e, a += m * k, b += k * n, c += m * n)
+				for (size_t i = 0; i < m; ++i)
+					for (size_t j = 0; j < n; ++j)
+					{
+						Type sum = 0;
+						for (size_t p = 0; p < k; ++p)
+							sum += a[i * k + p] * b[p * n + j];
+						c[i * n + j] = sum;
+					}
+		}
+
+		//-------------------------------------------------------------------------------
+		//--------------------------------Activations------------------------------------
+		//-------------------------------------------------------------------------------
+
+		//exp(x) = 2^n * e^r with r = x - n ln2 in [-ln2 / 2, ln2 / 2] and e^r a Taylor polynomial of Degree.
+		//The relative error is at most r^(Degree + 1) / (Degree + 1)! plus rounding: 4e-18 for 13 and 2.4e-6 for 5.
+		//x is clamped to [-708, 708] so 2^n stays a normal double, NaN stays NaN
+		struct _ExpConstants_
+		{
+			static constexpr double LIMIT = 708;
+			//Adding it rounds to an integer kept in the low mantissa bits
+			static constexpr double SHIFT = 6755399441055744.;
+			static constexpr double LOG2E = 1.4426950408889634;
+			//ln2 split so n * LN2_HI is exact
+			static constexpr double LN2_HI = 6.93147180369123816490e-01;
+			static constexpr double LN2_LO = 1.90821492927058770002e-10;
+
+			//1 / k!
+			static constexpr double COEFFICIENT[14] = { 1.0, 1.0, 0.5, 0.16666666666666666, 0.041666666666666664, 0.008333333333333333, 0.001388888888888889, 0.0001984126984126984, 2.48015873015873e-05, 2.7557319223985893e-06, 2.755731922398589e-07, 2.505210838544172e-08, 2.08767569878681e-09, 1.6059043836821613e-10 };
+		};
+
+		//Same operations as the register kernels, which use it for their tails
+		template<size_t Degree>
+		double _exp_(double x)
+		{
+			static_assert(Degree < 14, "Simd: _exp_: degree past the coefficients.");
+			using E = _ExpConstants_;
+			x = std::min(std::max(x, -E::LIMIT), E::LIMIT);
+
+			const double t = x * E::LOG2E + E::SHIFT, n = t - E::SHIFT;
+			const double r = (x - n * E::LN2_HI) - n * E::LN2_LO;
+
+			double p = E::COEFFICIENT[Degree];
+			for (size_t k = Degree; k-- > 0;)
+				p = p * r + E::COEFFICIENT[k];
+
+			uint64_t bits;
+			std::memcpy(&bits, &t, sizeof(bits));
+			bits = (bits + 1023) << 52;
+			double scale;
+			std::memcpy(&scale, &bits, sizeof(scale));
+
+			return p * scale;
+		}
+
+		//Activations of a layer's outputs, derive gives the derivative from the output instead of the input.
+		//Only double has register kernels
+		template<size_t Degree>
+		struct SigmoidOf
+		{
+			static double apply(const double &x) { return 1 / (1 + _exp_<Degree>(-x)); }
+			static double derive(const double &out) { return out * (1 - out); }
+		};
+		//Within a few ulp of 1 / (1 + std::exp(-x))
+		using Sigmoid = SigmoidOf<13>;
+		//Within 1e-6 of Sigmoid and about twice as fast
+		using FastSigmoid = SigmoidOf<5>;
+
+		//2 sigmoid(2x) - 1, the absolute error is that of Sigmoid
+		struct Tanh
+		{
+			static double apply(const double &x) { return 2 / (1 + _exp_<13>(-2 * x)) - 1; }
+			static double derive(const double &out) { return 1 - out * out; }
+		};
+
+		struct Relu
+		{
+			//Same operand order as Max, so NaN stays NaN
+			static double apply(const double &x) { return Max::apply(0., x); }
+			static double derive(const double &out) { return out > 0 ? 1 : 0; }
+		};
+
+		struct Exp
+		{
+			static double apply(const double &x) { return _exp_<13>(x); }
+		};
+
+		//-------------------------------------------------------------------------------
+		//--------------------------------Optimizers-------------------------------------
+		//-------------------------------------------------------------------------------
+
+		//Of one optimizer step, gradients are multiplied by scale before use.
+		//decay1 is the momentum or Adam's beta1, decay2 RMSProp's or Adam's beta2
+		struct StepCoefficients
+		{
+			double rate = 0;
+			double scale = 1;
+			double decay1 = 0;
+			double decay2 = 0;
+			double epsilon = 0;
+		};
+
+		//Update of element i of weights w from gradients g, m and v are the first and second moments.
+		//Steps only touch the moments they use, the others may be null
+		struct SgdStep
+		{
+			//w -= rate g
+			static void apply(const StepCoefficients &c, double *w, const double *g, double *, double *, const size_t &i)
+			{
+				w[i] -= c.rate * (c.scale * g[i]);
+			}
+		};
+
+		struct MomentumStep
+		{
+			//m = decay1 m + g, w -= rate m
+			static void apply(const StepCoefficients &c, double *w, const double *g, double *m, double *, const size_t &i)
+			{
+				m[i] = c.decay1 * m[i] + c.scale * g[i];
+				w[i] -= c.rate * m[i];
+			}
+		};
+
+		struct RmsPropStep
+		{
+			//v = decay2 v + (1 - decay2) g^2, w -= rate g / (sqrt(v) + epsilon)
+			static void apply(const StepCoefficients &c, double *w, const double *g, double *, double *v, const size_t &i)
+			{
+				const auto grad = c.scale * g[i];
+				v[i] = c.decay2 * v[i] + (1 - c.decay2) * (grad * grad);
+				w[i] -= c.rate * grad / (std::sqrt(v[i]) + c.epsilon);
+			}
+		};
+
+		//Bias correction is left to the caller, folded into rate and epsilon
+		struct AdamStep
+		{
+			//m = decay1 m + (1 - decay1) g, v as RMSProp's, w -= rate m / (sqrt(v) + epsilon)
+			static void apply(const StepCoefficients &c, double *w, const double *g, double *m, double *v, const size_t &i)
+			{
+				const auto grad = c.scale * g[i];
+				m[i] = c.decay1 * m[i] + (1 - c.decay1) * grad;
+				v[i] = c.decay2 * v[i] + (1 - c.decay2) * (grad * grad);
+				w[i] -= c.rate * m[i] / (std::sqrt(v[i]) + c.epsilon);
+			}
+		};
+
+		//Widest register of any instruction set, in elements
+		template<typename Type>
+		constexpr size_t MAX_WIDTH = 32 / sizeof(Type);
+
+		//-------------------------------------------------------------------------------
+		//--------------------------------Registers--------------------------------------
+		//-------------------------------------------------------------------------------
+
+#ifdef CTL_SIMD_X86
+		//Register wrappers, only specialized for the types an instruction set handles
+		template<typename Type, typename = void>
+		struct Sse2 { static constexpr bool valid = false; };
+		template<typename Type, typename = void>
+		struct Avx2 { static constexpr bool valid = false; };
+
+		template<>
+		struct Sse2<float>
+		{
+			static constexpr bool valid = true;
+			static constexpr size_t width = 4;
+			using Reg = __m128;
+
+			static Reg load(const float *p) { return _mm_loadu_ps(p); }
+			static void store(float *p, const Reg &r) { _mm_storeu_ps(p, r); }
+			static Reg set1(const float &x) { return _mm_set1_ps(x); }
+
+			template<typename Op> static constexpr bool has = true;
+			static Reg op(Add, const Reg &a, const Reg &b) { return _mm_add_ps(a, b); }
+			static Reg op(Sub, const Reg &a, const Reg &b) { return _mm_sub_ps(a, b); }
+			static Reg op(Mul, const Reg &a, const Reg &b) { return _mm_mul_ps(a, b); }
+			static Reg op(Div, const Reg &a, const Reg &b) { return _mm_div_ps(a, b); }
+			static Reg op(Min, const Reg &a, const Reg &b) { return _mm_min_ps(a, b); }
+			static Reg op(Max, const Reg &a, const Reg &b) { return _mm_max_ps(a, b); }
+			static Reg op(Identity, const Reg &x) { return x; }
+			static Reg op(Abs, const Reg &x) { return _mm_andnot_ps(_mm_set1_ps(-0.f), x); }
+			static Reg op(Square, const Reg &x) { return _mm_mul_ps(x, x); }
+			static Reg op(Sqrt, const Reg &x) { return _mm_sqrt_ps(x); }
+		};
+
+		template<>
+		struct Sse2<double>
+		{
+			static constexpr bool valid = true;
+			static constexpr size_t width = 2;
+			using Reg = __m128d;
+
+			static Reg load(const double *p) { return _mm_loadu_pd(p); }
+			static void store(double *p, const Reg &r) { _mm_storeu_pd(p, r); }
+			static Reg set1(const double &x) { return _mm_set1_pd(x); }
+
+			template<typename Op> static constexpr bool has = true;
+			static Reg op(Add, const Reg &a, const Reg &b) { return _mm_add_pd(a, b); }
+			static Reg op(Sub, const Reg &a, const Reg &b) { return _mm_sub_pd(a, b); }
+			static Reg op(Mul, const Reg &a, const Reg &b) { return _mm_mul_pd(a, b); }
+			static Reg op(Div, const Reg &a, const Reg &b) { return _mm_div_pd(a, b); }
+			static Reg op(Min, const Reg &a, const Reg &b) { return _mm_min_pd(a, b); }
+			static Reg op(Max, const Reg &a, const Reg &b) { return _mm_max_pd(a, b); }
+			static Reg op(Identity, const Reg &x) { return x; }
+			static Reg op(Abs, const Reg &x) { return _mm_andnot_pd(_mm_set1_pd(-0.), x); }
+			static Reg op(Square, const Reg &x) { return _mm_mul_pd(x, x); }
+			static Reg op(Sqrt, const Reg &x) { return _mm_sqrt_pd(x); }
+
+			//2^n from t = n + _ExpConstants_::SHIFT, whose low mantissa bits hold n
+			static Reg pow2(const Reg &t) { return _mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(_mm_castpd_si128(t), _mm_set1_epi64x(1023)), 52)); }
+			//1 where x > 0, else 0
+			static Reg positive(const Reg &x) { return _mm_and_pd(_mm_cmpgt_pd(x, _mm_setzero_pd()), _mm_set1_pd(1.)); }
+		};
+
+		//Wrapping integer arithmetic, the sign doesn't change add, sub or the low half of mul
+		template<typename Type>
+		struct Sse2<Type, std::enable_if_t<std::is_integral_v<Type> && !std::is_same_v<Type, bool>>>
+		{
+			static constexpr bool valid = true;
+			static constexpr size_t width = 16 / sizeof(Type);
+			using Reg = __m128i;
+
+			static Reg load(const Type *p) { return _mm_loadu_si128(reinterpret_cast<const Reg*>(p)); }
+			static void store(Type *p, const Reg &r) { _mm_storeu_si128(reinterpret_cast<Reg*>(p), r); }
+			static Reg set1(const Type &x)
+			{
+				if constexpr (sizeof(Type) == 1) return _mm_set1_epi8(static_cast<char>(x));
+				else if constexpr (sizeof(Type) == 2) return _mm_set1_epi16(static_cast<short>(x));
+				else if constexpr (sizeof(Type) == 4) return _mm_set1_epi32(static_cast<int>(x));
+				else return _mm_set1_epi64x(static_cast<long long>(x));
+			}
+
+			template<typename Op> static constexpr bool has =
+				std::is_same_v<Op, Add> || std::is_same_v<Op, Sub> || (std::is_same_v<Op, Mul> && sizeof(Type) == 2) || std::is_same_v<Op, Identity>;
+			static Reg op(Add, const Reg &a, const Reg &b)
+			{
+				if constexpr (sizeof(Type) == 1) return _mm_add_epi8(a, b);
+				else if constexpr (sizeof(Type) == 2) return _mm_add_epi16(a, b);
+				else if constexpr (sizeof(Type) == 4) return _mm_add_epi32(a, b);
+				else return _mm_add_epi64(a, b);
+			}
+			static Reg op(Sub, const Reg &a, const Reg &b)
+			{
+				if constexpr (sizeof(Type) == 1) return _mm_sub_epi8(a, b);
+				else if constexpr (sizeof(Type) == 2) return _mm_sub_epi16(a, b);
+				else if constexpr (sizeof(Type) == 4) return _mm_sub_epi32(a, b);
+				else return _mm_sub_epi64(a, b);
+			}
+			static Reg op(Mul, const Reg &a, const Reg &b) { return _mm_mullo_epi16(a, b); }
+			static Reg op(Identity, const Reg &x) { return x; }
+		};
+
+		template<>
+		struct Avx2<float>
+		{
+			static constexpr bool valid = true;
+			static constexpr size_t width = 8;
+			using Reg = __m256;
+
+			CTL_TARGET_AVX2 static Reg load(const float *p) { return _mm256_loadu_ps(p); }
+			CTL_TARGET_AVX2 static void store(float *p, const Reg &r) { _mm256_storeu_ps(p, r); }
+			CTL_TARGET_AVX2 static Reg set1(const float &x) { return _mm256_set1_ps(x); }
+
+			template<typename Op> static constexpr bool has = true;
+			CTL_TARGET_AVX2 static Reg op(Add, const Reg &a, const Reg &b) { return _mm256_add_ps(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Sub, const Reg &a, const Reg &b) { return _mm256_sub_ps(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Mul, const Reg &a, const Reg &b) { return _mm256_mul_ps(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Div, const Reg &a, const Reg &b) { return _mm256_div_ps(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Min, const Reg &a, const Reg &b) { return _mm256_min_ps(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Max, const Reg &a, const Reg &b) { return _mm256_max_ps(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Identity, const Reg &x) { return x; }
+			CTL_TARGET_AVX2 static Reg op(Abs, const Reg &x) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), x); }
+			CTL_TARGET_AVX2 static Reg op(Square, const Reg &x) { return _mm256_mul_ps(x, x); }
+			CTL_TARGET_AVX2 static Reg op(Sqrt, const Reg &x) { return _mm256_sqrt_ps(x); }
+		};
+
+		template<>
+		struct Avx2<double>
+		{
+			static constexpr bool valid = true;
+			static constexpr size_t width = 4;
+			using Reg = __m256d;
+
+			CTL_TARGET_AVX2 static Reg load(const double *p) { return _mm256_loadu_pd(p); }
+			CTL_TARGET_AVX2 static void store(double *p, const Reg &r) { _mm256_storeu_pd(p, r); }
+			CTL_TARGET_AVX2 static Reg set1(const double &x) { return _mm256_set1_pd(x); }
+
+			template<typename Op> static constexpr bool has = true;
+			CTL_TARGET_AVX2 static Reg op(Add, const Reg &a, const Reg &b) { return _mm256_add_pd(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Sub, const Reg &a, const Reg &b) { return _mm256_sub_pd(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Mul, const Reg &a, const Reg &b) { return _mm256_mul_pd(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Div, const Reg &a, const Reg &b) { return _mm256_div_pd(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Min, const Reg &a, const Reg &b) { return _mm256_min_pd(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Max, const Reg &a, const Reg &b) { return _mm256_max_pd(a, b); }
+			CTL_TARGET_AVX2 static Reg op(Identity, const Reg &x) { return x; }
+			CTL_TARGET_AVX2 static Reg op(Abs, const Reg &x) { return _mm256_andnot_pd(_mm256_set1_pd(-0.), x); }
+			CTL_TARGET_AVX2 static Reg op(Square, const Reg &x) { return _mm256_mul_pd(x, x); }
+			CTL_TARGET_AVX2 static Reg op(Sqrt, const Reg &x) { return _mm256_sqrt_pd(x); }
+
+			CTL_TARGET_AVX2 static Reg pow2(const Reg &t) { return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(t), _mm256_set1_epi64x(1023)), 52)); }
+			CTL_TARGET_AVX2 static Reg positive(const Reg &x) { return _mm256_and_pd(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ), _mm256_set1_pd(1.)); }
+		};
+
+		template<typename Type>
+		struct Avx2<Type, std::enable_if_t<std::is_integral_v<Type> && !std::is_same_v<Type, bool>>>
+		{
+			static constexpr bool valid = true;
+			static constexpr size_t width = 32 / sizeof(Type);
+			using Reg = __m256i;
+
+			CTL_TARGET_AVX2 static Reg load(const Type *p) { return _mm256_loadu_si256(reinterpret_cast<const Reg*>(p)); }
+			CTL_TARGET_AVX2 static void store(Type *p, const Reg &r) { _mm256_storeu_si256(reinterpret_cast<Reg*>(p), r); }
+			CTL_TARGET_AVX2 static Reg set1(const Type &x)
+			{
+				if constexpr (sizeof(Type) == 1) return _mm256_set1_epi8(static_cast<char>(x));
+				else if constexpr (sizeof(Type) == 2) return _mm256_set1_epi16(static_cast<short>(x));
+				else if constexpr (sizeof(Type) == 4) return _mm256_set1_epi32(static_cast<int>(x));
+				else return _mm256_set1_epi64x(static_cast<long long>(x));
+			}
+
+			template<typename Op> static constexpr bool has =
+				std::is_same_v<Op, Add> || std::is_same_v<Op, Sub> || (std::is_same_v<Op, Mul> && (sizeof(Type) == 2 || sizeof(Type) == 4)) || std::is_same_v<Op, Identity>;
+			CTL_TARGET_AVX2 static Reg op(Add, const Reg &a, const Reg &b)
+			{
+				if constexpr (sizeof(Type) == 1) return _mm256_add_epi8(a, b);
+				else if constexpr (sizeof(Type) == 2) return _mm256_add_epi16(a, b);
+				else if constexpr (sizeof(Type) == 4) return _mm256_add_epi32(a, b);
+				else return _mm256_add_epi64(a, b);
+			}
+			CTL_TARGET_AVX2 static Reg op(Sub, const Reg &a, const Reg &b)
+			{
+				if constexpr (sizeof(Type) == 1) return _mm256_sub_epi8(a, b);
+				else if constexpr (sizeof(Type) == 2) return _mm256_sub_epi16(a, b);
+				else if constexpr (sizeof(Type) == 4) return _mm256_sub_epi32(a, b);
+				else return _mm256_sub_epi64(a, b);
+			}
+			CTL_TARGET_AVX2 static Reg op(Mul, const Reg &a, const Reg &b)
+			{
+				if constexpr (sizeof(Type) == 2) return _mm256_mullo_epi16(a, b);
+				else return _mm256_mullo_epi32(a, b);
+			}
+			CTL_TARGET_AVX2 static Reg op(Identity, const Reg &x) { return x; }
+		};
+
+		//Eight reduced precision elements widened to floats
+		template<typename Format>
+		struct Avx2Widen;
+
+		template<>
+		struct Avx2Widen<F16>
+		{
+			CTL_TARGET_AVX2 static __m256 load(const uint16_t *p) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+		};
+
+		template<>
+		struct Avx2Widen<BF16>
+		{
+			CTL_TARGET_AVX2 static __m256 load(const uint16_t *p)
+			{
+				return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))), 16));
+			}
+		};
+
+		template<>
+		struct Avx2Widen<I8>
+		{
+			CTL_TARGET_AVX2 static __m256 load(const int8_t *p)
+			{
+				return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+			}
+		};
+
+		//-------------------------------------------------------------------------------
+		//---------------------------------Kernels---------------------------------------
+		//-------------------------------------------------------------------------------
+
+		//Kernels written once against a register wrapper are stamped out per instruction set by a macro,
+		//set names them _sse2X_ or _avx2X_, Vec is the wrapper and TARGET enables its instructions
+
+		//Unrolled twice so loads of the next register overlap the current operation
+#define CTL_SIMD_ARITH(set, Vec, TARGET) \
+		template<typename Op, typename Type> \
+		TARGET void _##set##Arith_(const Type *a, const Type *b, Type *to, const size_t &n) \
+		{ \
+			using V = Vec<Type>; \
+			size_t i = 0; \
+			for (; i + 2 * V::width <= n; i += 2 * V::width) \
+			{ \
+				const auto x = V::op(Op(), V::load(a + i), V::load(b + i)); \
+				const auto y = V::op(Op(), V::load(a + i + V::width), V::load(b + i + V::width)); \
+				V::store(to + i, x); \
+				V::store(to + i + V::width, y); \
+			} \
+			for (; i < n; ++i) \
+				to[i] = Op::apply(a[i], b[i]); \
+		} \
+		template<typename Op, bool swap, typename Type> \
+		TARGET void _##set##Scalar_(const Type *a, const Type b, Type *to, const size_t &n) \
+		{ \
+			using V = Vec<Type>; \
+			const auto s = V::set1(b); \
+			size_t i = 0; \
+			for (; i + 2 * V::width <= n; i += 2 * V::width) \
+			{ \
+				const auto x = V::load(a + i), y = V::load(a + i + V::width); \
+				V::store(to + i, swap ? V::op(Op(), s, x) : V::op(Op(), x, s)); \
+				V::store(to + i + V::width, swap ? V::op(Op(), s, y) : V::op(Op(), y, s)); \
+			} \
+			for (; i < n; ++i) \
+				to[i] = swap ? Op::apply(b, a[i]) : Op::apply(a[i], b); \
+		}
+CTL_SIMD_ARITH(sse2, Sse2, )
+CTL_SIMD_ARITH(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_ARITH
+
+		//Rows of a against b, four rows share each load of b.
+		//Each row sums in V::width lanes that are added together at the end
+#define CTL_SIMD_DOT_ROWS(set, Vec, TARGET) \
+		template<typename Type> \
+		TARGET void _##set##DotRows_(const Type *a, const size_t &aRow, const size_t &rows, const Type *b, const size_t &n, Type *to, const size_t &toStride) \
+		{ \
+			using V = Vec<Type>; \
+\
+			auto lanes = [](const Type *part) \
+			{ \
+				Type sum = part[0]; \
+				for (size_t i = 1; i < V::width; ++i) \
+					sum += part[i]; \
+				return sum; \
+			}; \
+			Type part[4][V::width]; \
+\
+			size_t r = 0; \
+			for (; r + 4 <= rows; r += 4) \
+			{ \
+				const Type *a0 = a + r * aRow, *a1 = a0 + aRow, *a2 = a1 + aRow, *a3 = a2 + aRow; \
+				auto s0 = V::set1(Type(0)), s1 = s0, s2 = s0, s3 = s0; \
+\
+				size_t i = 0; \
+				for (; i + V::width <= n; i += V::width) \
+				{ \
+					const auto x = V::load(b + i); \
+					s0 = V::op(Add(), s0, V::op(Mul(), V::load(a0 + i), x)); \
+					s1 = V::op(Add(), s1, V::op(Mul(), V::load(a1 + i), x)); \
+					s2 = V::op(Add(), s2, V::op(Mul(), V::load(a2 + i), x)); \
+					s3 = V::op(Add(), s3, V::op(Mul(), V::load(a3 + i), x)); \
+				} \
+				V::store(part[0], s0); \
+				V::store(part[1], s1); \
+				V::store(part[2], s2); \
+				V::store(part[3], s3); \
+\
+				Type t0 = lanes(part[0]), t1 = lanes(part[1]), t2 = lanes(part[2]), t3 = lanes(part[3]); \
+				for (; i < n; ++i) \
+				{ \
+					t0 += a0[i] * b[i]; \
+					t1 += a1[i] * b[i]; \
+					t2 += a2[i] * b[i]; \
+					t3 += a3[i] * b[i]; \
+				} \
+\
+				to[r * toStride] += t0; \
+				to[(r + 1) * toStride] += t1; \
+				to[(r + 2) * toStride] += t2; \
+				to[(r + 3) * toStride] += t3; \
+			} \
+\
+			for (; r < rows; ++r) \
+			{ \
+				const Type *a0 = a + r * aRow; \
+				auto s0 = V::set1(Type(0)); \
+\
+				size_t i = 0; \
+				for (; i + V::width <= n; i += V::width) \
+					s0 = V::op(Add(), s0, V::op(Mul(), V::load(a0 + i), V::load(b + i))); \
+				V::store(part[0], s0); \
+\
+				Type t0 = lanes(part[0]); \
+				for (; i < n; ++i) \
+					t0 += a0[i] * b[i]; \
+\
+				to[r * toStride] += t0; \
+			} \
+		}
+CTL_SIMD_DOT_ROWS(sse2, Sse2, )
+CTL_SIMD_DOT_ROWS(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_DOT_ROWS
+
+		//to[i] += x * a[i], elementwise so the result matches a scalar loop
+#define CTL_SIMD_AXPY(set, Vec, TARGET) \
+		template<typename Type> \
+		TARGET void _##set##Axpy_(const Type x, const Type *a, Type *to, const size_t &n) \
+		{ \
+			using V = Vec<Type>; \
+			const auto s = V::set1(x); \
+			size_t i = 0; \
+			for (; i + 2 * V::width <= n; i += 2 * V::width) \
+			{ \
+				V::store(to + i, V::op(Add(), V::load(to + i), V::op(Mul(), s, V::load(a + i)))); \
+				V::store(to + i + V::width, V::op(Add(), V::load(to + i + V::width), V::op(Mul(), s, V::load(a + i + V::width)))); \
+			} \
+			for (; i < n; ++i) \
+				to[i] += x * a[i]; \
+		}
+CTL_SIMD_AXPY(sse2, Sse2, )
+CTL_SIMD_AXPY(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_AXPY
+
+		//Op over Map(a[i]) for n of at least four registers.
+		//Four registers so consecutive ops don't wait on each other
+#define CTL_SIMD_REDUCE(set, Vec, TARGET) \
+		template<typename Op, typename Map, typename Type> \
+		TARGET Type _##set##Reduce_(const Type *a, const size_t &n) \
+		{ \
+			using V = Vec<Type>; \
+			auto s0 = V::op(Map(), V::load(a)), s1 = V::op(Map(), V::load(a + V::width)); \
+			auto s2 = V::op(Map(), V::load(a + 2 * V::width)), s3 = V::op(Map(), V::load(a + 3 * V::width)); \
+\
+			size_t i = 4 * V::width; \
+			for (; i + 4 * V::width <= n; i += 4 * V::width) \
+			{ \
+				s0 = V::op(Op(), s0, V::op(Map(), V::load(a + i))); \
+				s1 = V::op(Op(), s1, V::op(Map(), V::load(a + i + V::width))); \
+				s2 = V::op(Op(), s2, V::op(Map(), V::load(a + i + 2 * V::width))); \
+				s3 = V::op(Op(), s3, V::op(Map(), V::load(a + i + 3 * V::width))); \
+			} \
+\
+			Type part[V::width]; \
+			V::store(part, V::op(Op(), V::op(Op(), s0, s1), V::op(Op(), s2, s3))); \
+			Type result = part[0]; \
+			for (size_t j = 1; j < V::width; ++j) \
+				result = Op::apply(result, part[j]); \
+\
+			for (; i < n; ++i) \
+				result = Op::apply(result, Map::apply(a[i])); \
+			return result; \
+		}
+CTL_SIMD_REDUCE(sse2, Sse2, )
+CTL_SIMD_REDUCE(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_REDUCE
+
+#define CTL_SIMD_SUM_ORDERED(set, Vec, TARGET) \
+		template<typename Map, typename Type> \
+		TARGET Type _##set##SumOrdered_(const Type *a, const size_t &n) \
+		{ \
+			using V = Vec<Type>; \
+			constexpr size_t R = ORDERED_LANES / V::width; \
+\
+			typename V::Reg s[R]; \
+			for (size_t r = 0; r < R; ++r) \
+				s[r] = V::set1(Type(0)); \
+\
+			size_t i = 0; \
+			for (; i + ORDERED_LANES <= n; i += ORDERED_LANES) \
+				for (size_t r = 0; r < R; ++r) \
+					s[r] = V::op(Add(), s[r], V::op(Map(), V::load(a + i + r * V::width))); \
+\
+			Type lanes[ORDERED_LANES]; \
+			for (size_t r = 0; r < R; ++r) \
+				V::store(lanes + r * V::width, s[r]); \
+			return _orderedTail_<Map>(lanes, a, i, n); \
+		}
+CTL_SIMD_SUM_ORDERED(sse2, Sse2, )
+CTL_SIMD_SUM_ORDERED(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_SUM_ORDERED
+
+		//to[i] = scale * a[i] in float
+		template<typename Format>
+		CTL_TARGET_AVX2 void _avx2Widen_(const typename Format::storage *a, const float scale, float *to, const size_t &n)
+		{
+			const auto s = _mm256_set1_ps(scale);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+				_mm256_storeu_ps(to + i, _mm256_mul_ps(s, Avx2Widen<Format>::load(a + i)));
+			for (; i < n; ++i)
+				to[i] = scale * Format::decode(a[i]);
+		}
+
+		//Products of count small matrices, see batch. W entries are interleaved into work so each
+		//register holds the same element of W products, then unpacked into c
+#define CTL_SIMD_BATCH(set, Vec, TARGET) \
+		template<typename Type> \
+		TARGET void _##set##Batch_(const Type *a, const Type *b, Type *c, const size_t &m, const size_t &n, const size_t &k, const size_t &count, Type *work) \
+		{ \
+			using V = Vec<Type>; \
+			constexpr auto W = V::width; \
+			const auto mk = m * k, kn = k * n, mn = m * n; \
+			Type *pa = work, *pb = pa + mk * W, *pc = pb + kn * W; \
+\
+			size_t e = 0; \
+			for (; e + W <= count; e += W) \
+			{ \
+				for (size_t l = 0; l < W; ++l) \
+				{ \
+					for (size_t t = 0; t < mk; ++t) \
+						pa[t * W + l] = a[(e + l) * mk + t]; \
+					for (size_t t = 0; t < kn; ++t) \
+						pb[t * W + l] = b[(e + l) * kn + t]; \
+				} \
+\
+				for (size_t i = 0; i < m; ++i) \
+					for (size_t j = 0; j < n; ++j) \
+					{ \
+						auto sum = V::set1(Type(0)); \
+						for (size_t p = 0; p < k; ++p) \
+							sum = V::op(Add(), sum, V::op(Mul(), V::load(pa + (i * k + p) * W), V::load(pb + (p * n + j) * W))); \
+						V::store(pc + (i * n + j) * W, sum); \
+					} \
+\
+				for (size_t l = 0; l < W; ++l) \
+					for (size_t t = 0; t < mn; ++t) \
+						c[(e + l) * mn + t] = pc[t * W + l]; \
+			} \
+\
+			_batchScalar_(a + e * mk, b + e * kn, c + e * mn, m, n, k, count - e); \
+		}
+CTL_SIMD_BATCH(sse2, Sse2, )
+CTL_SIMD_BATCH(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_BATCH
+
+		//Lanes added in order, lambdas don't inherit the target so this is a function
+		CTL_TARGET_AVX2 inline float _avx2Lanes_(const __m256 &r)
+		{
+			float part[8];
+			_mm256_storeu_ps(part, r);
+			float sum = part[0];
+			for (size_t i = 1; i < 8; ++i)
+				sum += part[i];
+			return sum;
+		}
+
+		//Four rows share each load of b and keep separate sums, so consecutive adds don't wait on each other
+		template<typename Format>
+		CTL_TARGET_AVX2 void _avx2DotWiden_(const typename Format::storage *a, const size_t &aRow, const size_t &rows, const float *b, const size_t &n, float *to)
+		{
+			using W = Avx2Widen<Format>;
+
+			size_t r = 0;
+			for (; r + 4 <= rows; r += 4)
+			{
+				const auto *a0 = a + r * aRow, *a1 = a0 + aRow, *a2 = a1 + aRow, *a3 = a2 + aRow;
+				auto s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+
+				size_t i = 0;
+				for (; i + 8 <= n; i += 8)
+				{
+					const auto x = _mm256_loadu_ps(b + i);
+					s0 = _mm256_add_ps(s0, _mm256_mul_ps(W::load(a0 + i), x));
+					s1 = _mm256_add_ps(s1, _mm256_mul_ps(W::load(a1 + i), x));
+					s2 = _mm256_add_ps(s2, _mm256_mul_ps(W::load(a2 + i), x));
+					s3 = _mm256_add_ps(s3, _mm256_mul_ps(W::load(a3 + i), x));
+				}
+
+				float t0 = _avx2Lanes_(s0), t1 = _avx2Lanes_(s1), t2 = _avx2Lanes_(s2), t3 = _avx2Lanes_(s3);
+				for (; i < n; ++i)
+				{
+					t0 += Format::decode(a0[i]) * b[i];
+					t1 += Format::decode(a1[i]) * b[i];
+					t2 += Format::decode(a2[i]) * b[i];
+					t3 += Format::decode(a3[i]) * b[i];
+				}
+
+				to[r] = t0;
+				to[r + 1] = t1;
+				to[r + 2] = t2;
+				to[r + 3] = t3;
+			}
+
+			for (; r < rows; ++r)
+			{
+				const auto *a0 = a + r * aRow;
+				auto s0 = _mm256_setzero_ps();
+
+				size_t i = 0;
+				for (; i + 8 <= n; i += 8)
+					s0 = _mm256_add_ps(s0, _mm256_mul_ps(W::load(a0 + i), _mm256_loadu_ps(b + i)));
+
+				float t0 = _avx2Lanes_(s0);
+				for (; i < n; ++i)
+					t0 += Format::decode(a0[i]) * b[i];
+
+				to[r] = t0;
+			}
+		}
+
+		//int8 rows of a against b summed in int32. Both are sign extended to int16 and madd adds pairs of
+		//products, four rows share each extension of b
+		inline int32_t _sse2LanesI32_(const __m128i &r)
+		{
+			int32_t part[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(part), r);
+			return part[0] + part[1] + part[2] + part[3];
+		}
+		//Low and high eight bytes of p as int16
+		inline void _sse2WidenI8_(const int8_t *p, __m128i &lo, __m128i &hi)
+		{
+			const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+			hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+		}
+		inline __m128i _sse2MaddI8_(const int8_t *p, const __m128i &xLo, const __m128i &xHi, const __m128i &sum)
+		{
+			__m128i lo, hi;
+			_sse2WidenI8_(p, lo, hi);
+			return _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, xLo), _mm_madd_epi16(hi, xHi)));
+		}
+		inline void _sse2DotI8_(const int8_t *a, const size_t &aRow, const size_t &rows, const int8_t *b, const size_t &n, int32_t *to)
+		{
+			size_t r = 0;
+			for (; r + 4 <= rows; r += 4)
+			{
+				const auto *a0 = a + r * aRow, *a1 = a0 + aRow, *a2 = a1 + aRow, *a3 = a2 + aRow;
+				auto s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+
+				size_t i = 0;
+				for (; i + 16 <= n; i += 16)
+				{
+					__m128i xLo, xHi;
+					_sse2WidenI8_(b + i, xLo, xHi);
+					s0 = _sse2MaddI8_(a0 + i, xLo, xHi, s0);
+					s1 = _sse2MaddI8_(a1 + i, xLo, xHi, s1);
+					s2 = _sse2MaddI8_(a2 + i, xLo, xHi, s2);
+					s3 = _sse2MaddI8_(a3 + i, xLo, xHi, s3);
+				}
+
+				int32_t t0 = _sse2LanesI32_(s0), t1 = _sse2LanesI32_(s1), t2 = _sse2LanesI32_(s2), t3 = _sse2LanesI32_(s3);
+				for (; i < n; ++i)
+				{
+					t0 += int32_t(a0[i]) * b[i];
+					t1 += int32_t(a1[i]) * b[i];
+					t2 += int32_t(a2[i]) * b[i];
+					t3 += int32_t(a3[i]) * b[i];
+				}
+
+				to[r] = t0;
+				to[r + 1] = t1;
+				to[r + 2] = t2;
+				to[r + 3] = t3;
+			}
+
+			for (; r < rows; ++r)
+			{
+				const auto *a0 = a + r * aRow;
+				auto s0 = _mm_setzero_si128();
+
+				size_t i = 0;
+				for (; i + 16 <= n; i += 16)
+				{
+					__m128i xLo, xHi;
+					_sse2WidenI8_(b + i, xLo, xHi);
+					s0 = _sse2MaddI8_(a0 + i, xLo, xHi, s0);
+				}
+
+				int32_t t0 = _sse2LanesI32_(s0);
+				for (; i < n; ++i)
+					t0 += int32_t(a0[i]) * b[i];
+
+				to[r] = t0;
+			}
+		}
+
+		CTL_TARGET_AVX2 inline int32_t _avx2LanesI32_(const __m256i &r)
+		{
+			return _sse2LanesI32_(_mm_add_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+		}
+		//Sixteen bytes of p as int16
+		CTL_TARGET_AVX2 inline __m256i _avx2WidenI8_(const int8_t *p) { return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+		CTL_TARGET_AVX2 inline void _avx2DotI8_(const int8_t *a, const size_t &aRow, const size_t &rows, const int8_t *b, const size_t &n, int32_t *to)
+		{
+			size_t r = 0;
+			for (; r + 4 <= rows; r += 4)
+			{
+				const auto *a0 = a + r * aRow, *a1 = a0 + aRow, *a2 = a1 + aRow, *a3 = a2 + aRow;
+				auto s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+
+				size_t i = 0;
+				for (; i + 16 <= n; i += 16)
+				{
+					const auto x = _avx2WidenI8_(b + i);
+					s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_avx2WidenI8_(a0 + i), x));
+					s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_avx2WidenI8_(a1 + i), x));
+					s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_avx2WidenI8_(a2 + i), x));
+					s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_avx2WidenI8_(a3 + i), x));
+				}
+
+				int32_t t0 = _avx2LanesI32_(s0), t1 = _avx2LanesI32_(s1), t2 = _avx2LanesI32_(s2), t3 = _avx2LanesI32_(s3);
+				for (; i < n; ++i)
+				{
+					t0 += int32_t(a0[i]) * b[i];
+					t1 += int32_t(a1[i]) * b[i];
+					t2 += int32_t(a2[i]) * b[i];
+					t3 += int32_t(a3[i]) * b[i];
+				}
+
+				to[r] = t0;
+				to[r + 1] = t1;
+				to[r + 2] = t2;
+				to[r + 3] = t3;
+			}
+
+			for (; r < rows; ++r)
+			{
+				const auto *a0 = a + r * aRow;
+				auto s0 = _mm256_setzero_si256();
+
+				size_t i = 0;
+				for (; i + 16 <= n; i += 16)
+					s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_avx2WidenI8_(a0 + i), _avx2WidenI8_(b + i)));
+
+				int32_t t0 = _avx2LanesI32_(s0);
+				for (; i < n; ++i)
+					t0 += int32_t(a0[i]) * b[i];
+
+				to[r] = t0;
+			}
+		}
+
+		//Register exp, the same operations as _exp_. Horner is p * r + COEFFICIENT[k] for k from K - 1 down to 0,
+		//unrolled so each step is a constant
+#define CTL_SIMD_EXP(set, Vec, TARGET) \
+		template<size_t K> \
+		TARGET inline Vec<double>::Reg _##set##Horner_(const Vec<double>::Reg &p, const Vec<double>::Reg &r) \
+		{ \
+			using V = Vec<double>; \
+			if constexpr (K == 0) \
+				return p; \
+			else \
+				return _##set##Horner_<K - 1>(V::op(Add(), V::op(Mul(), p, r), V::set1(_ExpConstants_::COEFFICIENT[K - 1])), r); \
+		} \
+\
+		template<size_t Degree> \
+		TARGET inline Vec<double>::Reg _##set##Exp_(Vec<double>::Reg x) \
+		{ \
+			using V = Vec<double>; \
+			using E = _ExpConstants_; \
+			x = V::op(Min(), V::set1(E::LIMIT), V::op(Max(), V::set1(-E::LIMIT), x)); \
+\
+			const auto t = V::op(Add(), V::op(Mul(), x, V::set1(E::LOG2E)), V::set1(E::SHIFT)), n = V::op(Sub(), t, V::set1(E::SHIFT)); \
+			const auto r = V::op(Sub(), V::op(Sub(), x, V::op(Mul(), n, V::set1(E::LN2_HI))), V::op(Mul(), n, V::set1(E::LN2_LO))); \
+\
+			const auto p = _##set##Horner_<Degree>(V::set1(E::COEFFICIENT[Degree]), r); \
+\
+			return V::op(Mul(), p, V::pow2(t)); \
+		}
+CTL_SIMD_EXP(sse2, Sse2, )
+CTL_SIMD_EXP(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_EXP
+
+		//Apply is one register of an activation and Derive its derivative from a register of outputs,
+		//Activate and DeriveInto run them over arrays with the scalar functions for the tails
+#define CTL_SIMD_ACTIVATE(set, Vec, TARGET) \
+		template<size_t Degree> \
+		TARGET inline Vec<double>::Reg _##set##Apply_(SigmoidOf<Degree>, const Vec<double>::Reg &x) \
+		{ \
+			using V = Vec<double>; \
+			return V::op(Div(), V::set1(1.), V::op(Add(), V::set1(1.), _##set##Exp_<Degree>(V::op(Sub(), V::set1(0.), x)))); \
+		} \
+		TARGET inline Vec<double>::Reg _##set##Apply_(Tanh, const Vec<double>::Reg &x) \
+		{ \
+			using V = Vec<double>; \
+			const auto e = _##set##Exp_<13>(V::op(Mul(), V::set1(-2.), x)); \
+			return V::op(Sub(), V::op(Div(), V::set1(2.), V::op(Add(), V::set1(1.), e)), V::set1(1.)); \
+		} \
+		TARGET inline Vec<double>::Reg _##set##Apply_(Relu, const Vec<double>::Reg &x) { return Vec<double>::op(Max(), Vec<double>::set1(0.), x); } \
+		TARGET inline Vec<double>::Reg _##set##Apply_(Exp, const Vec<double>::Reg &x) { return _##set##Exp_<13>(x); } \
+		template<size_t Degree> \
+		TARGET inline Vec<double>::Reg _##set##Derive_(SigmoidOf<Degree>, const Vec<double>::Reg &out) \
+		{ \
+			using V = Vec<double>; \
+			return V::op(Mul(), out, V::op(Sub(), V::set1(1.), out)); \
+		} \
+		TARGET inline Vec<double>::Reg _##set##Derive_(Tanh, const Vec<double>::Reg &out) \
+		{ \
+			using V = Vec<double>; \
+			return V::op(Sub(), V::set1(1.), V::op(Mul(), out, out)); \
+		} \
+		TARGET inline Vec<double>::Reg _##set##Derive_(Relu, const Vec<double>::Reg &out) { return Vec<double>::positive(out); } \
+		template<typename Act> \
+		TARGET void _##set##Activate_(double *a, const size_t &n) \
+		{ \
+			using V = Vec<double>; \
+			size_t i = 0; \
+			for (; i + V::width <= n; i += V::width) \
+				V::store(a + i, _##set##Apply_(Act(), V::load(a + i))); \
+			for (; i < n; ++i) \
+				a[i] = Act::apply(a[i]); \
+		} \
+		template<typename Act> \
+		TARGET void _##set##DeriveInto_(const double *out, double *error, const size_t &n) \
+		{ \
+			using V = Vec<double>; \
+			size_t i = 0; \
+			for (; i + V::width <= n; i += V::width) \
+				V::store(error + i, V::op(Mul(), V::load(error + i), _##set##Derive_(Act(), V::load(out + i)))); \
+			for (; i < n; ++i) \
+				error[i] *= Act::derive(out[i]); \
+		}
+CTL_SIMD_ACTIVATE(sse2, Sse2, )
+CTL_SIMD_ACTIVATE(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_ACTIVATE
+
+		//Steps on the register of elements from i, the same operations as the scalar ones.
+		//c holds the coefficients broadcast, in the order of StepCoefficients
+#define CTL_SIMD_STEP(set, Vec, TARGET) \
+		TARGET inline void _##set##Update_(SgdStep, const Vec<double>::Reg (&c)[5], double *w, const double *g, double *, double *, const size_t &i) \
+		{ \
+			using V = Vec<double>; \
+			V::store(w + i, V::op(Sub(), V::load(w + i), V::op(Mul(), c[0], V::op(Mul(), c[1], V::load(g + i))))); \
+		} \
+		TARGET inline void _##set##Update_(MomentumStep, const Vec<double>::Reg (&c)[5], double *w, const double *g, double *m, double *, const size_t &i) \
+		{ \
+			using V = Vec<double>; \
+			const auto moment = V::op(Add(), V::op(Mul(), c[2], V::load(m + i)), V::op(Mul(), c[1], V::load(g + i))); \
+			V::store(m + i, moment); \
+			V::store(w + i, V::op(Sub(), V::load(w + i), V::op(Mul(), c[0], moment))); \
+		} \
+		TARGET inline void _##set##Update_(RmsPropStep, const Vec<double>::Reg (&c)[5], double *w, const double *g, double *, double *v, const size_t &i) \
+		{ \
+			using V = Vec<double>; \
+			const auto grad = V::op(Mul(), c[1], V::load(g + i)); \
+			const auto square = V::op(Add(), V::op(Mul(), c[3], V::load(v + i)), V::op(Mul(), V::op(Sub(), V::set1(1.), c[3]), V::op(Square(), grad))); \
+			V::store(v + i, square); \
+			const auto step = V::op(Div(), V::op(Mul(), c[0], grad), V::op(Add(), V::op(Sqrt(), square), c[4])); \
+			V::store(w + i, V::op(Sub(), V::load(w + i), step)); \
+		} \
+		TARGET inline void _##set##Update_(AdamStep, const Vec<double>::Reg (&c)[5], double *w, const double *g, double *m, double *v, const size_t &i) \
+		{ \
+			using V = Vec<double>; \
+			const auto grad = V::op(Mul(), c[1], V::load(g + i)); \
+			const auto moment = V::op(Add(), V::op(Mul(), c[2], V::load(m + i)), V::op(Mul(), V::op(Sub(), V::set1(1.), c[2]), grad)); \
+			const auto square = V::op(Add(), V::op(Mul(), c[3], V::load(v + i)), V::op(Mul(), V::op(Sub(), V::set1(1.), c[3]), V::op(Square(), grad))); \
+			V::store(m + i, moment); \
+			V::store(v + i, square); \
+			const auto step = V::op(Div(), V::op(Mul(), c[0], moment), V::op(Add(), V::op(Sqrt(), square), c[4])); \
+			V::store(w + i, V::op(Sub(), V::load(w + i), step)); \
+		} \
+		template<typename Step> \
+		TARGET void _##set##Step_(const StepCoefficients &k, double *w, const double *g, double *m, double *v, const size_t &n) \
+		{ \
+			using V = Vec<double>; \
+			const typename V::Reg c[5] = { V::set1(k.rate), V::set1(k.scale), V::set1(k.decay1), V::set1(k.decay2), V::set1(k.epsilon) }; \
+			size_t i = 0; \
+			for (; i + V::width <= n; i += V::width) \
+				_##set##Update_(Step(), c, w, g, m, v, i); \
+			for (; i < n; ++i) \
+				Step::apply(k, w, g, m, v, i); \
+		}
+CTL_SIMD_STEP(sse2, Sse2, )
+CTL_SIMD_STEP(avx2, Avx2, CTL_TARGET_AVX2)
+#undef CTL_SIMD_STEP
+
+#endif // CTL_SIMD_X86
+
+		//to[i] = a[i] op b[i], to may alias a or b
+		template<typename Op, typename Type>
+		void arith(const Type *a, const Type *b, Type *to, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Op>)
+				if (level() == Level::AVX2)
+					return _avx2Arith_<Op>(a, b, to, n);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Op>)
+				if (level() >= Level::SSE2)
+					return _sse2Arith_<Op>(a, b, to, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				to[i] = Op::apply(a[i], b[i]);
+		}
+
+		//to[i] = a[i] op b, or b op a[i] when swapped, to may alias a
+		//b is taken by value so it may be an element of a
+		template<typename Op, bool swap = false, typename Type>
+		void scalar(const Type *a, const Type b, Type *to, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Op>)
+				if (level() == Level::AVX2)
+					return _avx2Scalar_<Op, swap>(a, b, to, n);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Op>)
+				if (level() >= Level::SSE2)
+					return _sse2Scalar_<Op, swap>(a, b, to, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				to[i] = swap ? Op::apply(b, a[i]) : Op::apply(a[i], b);
+		}
+
+		//to[r * toStride] += dot(row r of a, b) for r < rows, rows are aRow apart.
+		//Vector lanes keep their own sums, so the result can differ from a serial loop in the last bits
+		template<typename Type>
+		void dotRows(const Type *a, const size_t &aRow, const size_t &rows, const Type *b, const size_t &n, Type *to, const size_t &toStride)
+		{
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Mul>)
+				if (level() == Level::AVX2)
+					return _avx2DotRows_(a, aRow, rows, b, n, to, toStride);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Mul>)
+				if (level() >= Level::SSE2)
+					return _sse2DotRows_(a, aRow, rows, b, n, to, toStride);
+#endif // CTL_SIMD_X86
+
+			for (size_t r = 0; r < rows; ++r)
+			{
+				Type sum = 0;
+				for (size_t i = 0; i < n; ++i)
+					sum += a[r * aRow + i] * b[i];
+				to[r * toStride] += sum;
+			}
+		}
+
+		//to[i] += x * a[i]
+		template<typename Type>
+		void axpy(const Type x, const Type *a, Type *to, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Mul>)
+				if (level() == Level::AVX2)
+					return _avx2Axpy_(x, a, to, n);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Mul>)
+				if (level() >= Level::SSE2)
+					return _sse2Axpy_(x, a, to, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				to[i] += x * a[i];
+		}
+
+		//to[i] = scale * a[i] widened to float, Format is F16, BF16 or I8.
+		//Only AVX2 has the widening loads, older sets use the scalar loop
+		template<typename Format>
+		void widen(const typename Format::storage *a, const float &scale, float *to, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if (level() == Level::AVX2)
+				return _avx2Widen_<Format>(a, scale, to, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				to[i] = scale * Format::decode(a[i]);
+		}
+
+		//to[i] = a[i] narrowed to Format after multiplying by scale.
+		//Runs once per conversion rather than per product, so it stays scalar
+		template<typename Format>
+		void narrow(const float *a, const float &scale, typename Format::storage *to, const size_t &n)
+		{
+			for (size_t i = 0; i < n; ++i)
+				to[i] = Format::encode(scale * a[i]);
+		}
+
+		//to[r] = dot(row r of a, b) for r < rows, rows are aRow apart.
+		//a is widened to float and the sums are kept in float
+		template<typename Format>
+		void dotWiden(const typename Format::storage *a, const size_t &aRow, const size_t &rows, const float *b, const size_t &n, float *to)
+		{
+#ifdef CTL_SIMD_X86
+			if (level() == Level::AVX2)
+				return _avx2DotWiden_<Format>(a, aRow, rows, b, n, to);
+#endif // CTL_SIMD_X86
+
+			for (size_t r = 0; r < rows; ++r)
+			{
+				float sum = 0;
+				for (size_t i = 0; i < n; ++i)
+					sum += Format::decode(a[r * aRow + i]) * b[i];
+				to[r] = sum;
+			}
+		}
+
+		//to[r] = dot(row r of a, b) for r < rows, rows are aRow apart. Products sum exactly in int32,
+		//so every instruction set gives the same result. Elements in [-127, 127], as I8 encodes, can't overflow for n up to 133144
+		inline void dotI8(const int8_t *a, const size_t &aRow, const size_t &rows, const int8_t *b, const size_t &n, int32_t *to)
+		{
+#ifdef CTL_SIMD_X86
+			if (level() == Level::AVX2)
+				return _avx2DotI8_(a, aRow, rows, b, n, to);
+			if (level() >= Level::SSE2)
+				return _sse2DotI8_(a, aRow, rows, b, n, to);
+#endif // CTL_SIMD_X86
+
+			for (size_t r = 0; r < rows; ++r)
+			{
+				int32_t sum = 0;
+				for (size_t i = 0; i < n; ++i)
+					sum += int32_t(a[r * aRow + i]) * b[i];
+				to[r] = sum;
+			}
+		}
+
+		//Op over Map(a[i]), Op is Add, Min or Max and Map is Identity, Abs or Square.
+		//Lanes reduce separately, so a sum can differ from a serial loop in the last bits. Add of nothing is 0
+		template<typename Op, typename Map = Identity, typename Type>
+		Type reduce(const Type *a, const size_t &n)
+		{
+			if (n == 0)
+				return Type(0);
+
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Op> && Avx2<Type>::template has<Map>)
+				if (level() == Level::AVX2 && n >= 4 * Avx2<Type>::width)
+					return _avx2Reduce_<Op, Map>(a, n);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Op> && Sse2<Type>::template has<Map>)
+				if (level() >= Level::SSE2 && n >= 4 * Sse2<Type>::width)
+					return _sse2Reduce_<Op, Map>(a, n);
+#endif // CTL_SIMD_X86
+
+			Type result = Map::apply(a[0]);
+			for (size_t i = 1; i < n; ++i)
+				result = Op::apply(result, Map::apply(a[i]));
+			return result;
+		}
+
+		//Sum of Map(a[i]) that is the same on every instruction set, see ORDERED_LANES
+		template<typename Map = Identity, typename Type>
+		Type sumOrdered(const Type *a, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Map> && ORDERED_LANES % Avx2<Type>::width == 0)
+				if (level() == Level::AVX2)
+					return _avx2SumOrdered_<Map>(a, n);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Map> && ORDERED_LANES % Sse2<Type>::width == 0)
+				if (level() >= Level::SSE2)
+					return _sse2SumOrdered_<Map>(a, n);
+#endif // CTL_SIMD_X86
+
+			Type lanes[ORDERED_LANES] = {};
+			size_t i = 0;
+			for (; i + ORDERED_LANES <= n; i += ORDERED_LANES)
+				for (size_t j = 0; j < ORDERED_LANES; ++j)
+					lanes[j] += Map::apply(a[i + j]);
+			return _orderedTail_<Map>(lanes, a, i, n);
+		}
+
+		//c[e] = a[e] x b[e] for e < count, with a[e] m x k, b[e] k x n and c[e] m x n row major and back to back.
+		//work holds (m * k + k * n + m * n) * MAX_WIDTH<Type> elements. Sums are in the same order as a naive loop
+		template<typename Type>
+		void batch(const Type *a, const Type *b, Type *c, const size_t &m, const size_t &n, const size_t &k, const size_t &count, Type *work)
+		{
+#ifdef CTL_SIMD_X86
+			if constexpr (Avx2<Type>::valid && Avx2<Type>::template has<Mul>)
+				if (level() == Level::AVX2)
+					return _avx2Batch_(a, b, c, m, n, k, count, work);
+			if constexpr (Sse2<Type>::valid && Sse2<Type>::template has<Mul>)
+				if (level() >= Level::SSE2)
+					return _sse2Batch_(a, b, c, m, n, k, count, work);
+#endif // CTL_SIMD_X86
+
+			_batchScalar_(a, b, c, m, n, k, count);
+		}
+
+		//a[i] = Act::apply(a[i]) in place, Act is Sigmoid, FastSigmoid, Tanh, Relu or Exp
+		template<typename Act>
+		void activate(double *a, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if (level() == Level::AVX2)
+				return _avx2Activate_<Act>(a, n);
+			if (level() >= Level::SSE2)
+				return _sse2Activate_<Act>(a, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				a[i] = Act::apply(a[i]);
+		}
+
+		//error[i] *= Act::derive(out[i]), the error through the activation that gave out
+		template<typename Act>
+		void derive(const double *out, double *error, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if (level() == Level::AVX2)
+				return _avx2DeriveInto_<Act>(out, error, n);
+			if (level() >= Level::SSE2)
+				return _sse2DeriveInto_<Act>(out, error, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				error[i] *= Act::derive(out[i]);
+		}
+
+		//a = exp(a - max(a)) / sum, shifted by the largest so nothing overflows
+		inline void softmax(double *a, const size_t &n)
+		{
+			if (n == 0)
+				return;
+
+			scalar<Sub>(a, reduce<Max>(a, n), a, n);
+			activate<Exp>(a, n);
+			scalar<Mul>(a, 1 / reduce<Add>(a, n), a, n);
+		}
+
+		//One pass of Step over n weights, each gradient read once and the moments Step uses updated in place.
+		//Step is SgdStep, MomentumStep, RmsPropStep or AdamStep, moments it doesn't use may be null
+		template<typename Step>
+		void step(const StepCoefficients &c, double *w, const double *g, double *m, double *v, const size_t &n)
+		{
+#ifdef CTL_SIMD_X86
+			if (level() == Level::AVX2)
+				return _avx2Step_<Step>(c, w, g, m, v, n);
+			if (level() >= Level::SSE2)
+				return _sse2Step_<Step>(c, w, g, m, v, n);
+#endif // CTL_SIMD_X86
+
+			for (size_t i = 0; i < n; ++i)
+				Step::apply(c, w, g, m, v, i);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include "Matrix.h"
+#include "ThreadPool.h"
+#include "Vector.h"
+#include "Error.h"
+
+namespace ctl
+{
+	//Compressed sparse rows. The non zeros of row y are values[rowPtr[y] .. rowPtr[y + 1]]
+	//with their columns in colIdx, sorted by column
+	template<typename Type>
+	class SparseMatrix
+	{
+		static_assert(std::is_arithmetic_v<Type>, "SparseMatrix: type must be arithmetic.");
+
+	public:
+		using value_type = Type;
+
+		//Coordinate form entry, column x of row y
+		struct Triplet
+		{
+			size_t x;
+			size_t y;
+			Type value;
+		};
+
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		SparseMatrix()
+			: m_rowPtr(1, 0)
+		{
+		}
+		SparseMatrix(const SparseMatrix &) = default;
+		SparseMatrix(SparseMatrix &&) = default;
+
+		//Triplets may come in any order, duplicates are summed
+		SparseMatrix(const NumVec<size_t, 2> &size, std::vector<Triplet> triplets)
+			: m_rowPtr(size[1] + 1, 0)
+			, m_dim(size)
+		{
+			for (const auto &i : triplets)
+				if (i.x >= m_dim[0] || i.y >= m_dim[1])
+					throw Log("SparseMatrix: constructor: triplet out of range.", Log::Severity::ERR0R);
+
+			std::sort(triplets.begin(), triplets.end(), [](const Triplet &a, const Triplet &b) { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+
+			m_colIdx.reserve(triplets.size());
+			m_values.reserve(triplets.size());
+
+			for (size_t i = 0; i < triplets.size(); ++i)
+			{
+				if (i > 0 && triplets[i].x == triplets[i - 1].x && triplets[i].y == triplets[i - 1].y)
+				{
+					m_values.back() += triplets[i].value;
+					continue;
+				}
+
+				m_colIdx.push_back(triplets[i].x);
+				m_values.push_back(triplets[i].value);
+				++m_rowPtr[triplets[i].y + 1];
+			}
+
+			for (size_t y = 0; y < m_dim[1]; ++y)
+				m_rowPtr[y + 1] += m_rowPtr[y];
+		}
+
+		//Keeps the non zero elements of a Matrix, view or expression
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		explicit SparseMatrix(const M &mat)
+			: m_rowPtr(mat.dim()[1] + 1, 0)
+			, m_dim(mat.dim())
+		{
+			for (size_t y = 0; y < m_dim[1]; ++y)
+			{
+				for (size_t x = 0; x < m_dim[0]; ++x)
+				{
+					const Type value = mat(x, y);
+					if (value != Type(0))
+					{
+						m_colIdx.push_back(x);
+						m_values.push_back(value);
+					}
+				}
+				m_rowPtr[y + 1] = m_values.size();
+			}
+		}
+
+		//---------------------------------------------------------
+		//----------------------Operators--------------------------
+		//---------------------------------------------------------
+
+		SparseMatrix& operator=(const SparseMatrix &) = default;
+		SparseMatrix& operator=(SparseMatrix &&) = default;
+
+		//Binary search in the row, zero when not stored
+		Type operator()(const size_t &x, const size_t &y) const
+		{
+			const auto begin = m_colIdx.begin() + m_rowPtr[y], end = m_colIdx.begin() + m_rowPtr[y + 1];
+			const auto found = std::lower_bound(begin, end, x);
+			return found != end && *found == x ? m_values[found - m_colIdx.begin()] : Type(0);
+		}
+
+		const auto& dim() const { return m_dim; }
+		size_t nonZeros() const { return m_values.size(); }
+
+		const auto& rowPtr() const { return m_rowPtr; }
+		const auto& colIdx() const { return m_colIdx; }
+		const auto& values() const { return m_values; }
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//Sparse x dense, mat2 is a Matrix, view or expression.
+		//Rows are split over the pool in ranges of about equal non zeros
+		template<typename M, typename = typename std::enable_if_t<_is_matrix_operand_<M>>>
+		auto dotProduct(const M &mat2, const Parallel &par = Parallel::global()) const
+		{
+			static_assert(std::is_same_v<Type, typename std::decay_t<M>::value_type>, "SparseMatrix: dotProduct: element types differ.");
+
+			if constexpr (_is_matrix_expr_<M>)
+				return dotProduct(typename std::decay_t<M>::matrix_type(mat2), par);
+			else
+			{
+				if (m_dim[0] != mat2.dim()[1])
+					throw Log("SparseMatrix: dotProduct: width not same as height.", Log::Severity::ERR0R);
+
+				const auto n = mat2.dim()[0];
+				Matrix<Type> mat({ n, m_dim[1] }, 0);
+				if (mat.dim().product() == 0)
+					return mat;
+
+				const auto b = _gemmOperandOf_(mat2);
+				auto *c = &mat.loc(0);
+
+				_parallelRows_(nonZeros() * n, par, [this, &b, c, n](const size_t &begin, const size_t &end)
+				{
+					for (size_t y = begin; y < end; ++y)
+					{
+						auto *cY = c + y * n;
+						for (size_t k = m_rowPtr[y]; k < m_rowPtr[y + 1]; ++k)
+						{
+							const auto value = m_values[k];
+							const auto *bX = &b(m_colIdx[k], 0);
+							if (b.col == 1)
+								for (size_t j = 0; j < n; ++j)
+									cY[j] += value * bX[j];
+							else
+								for (size_t j = 0; j < n; ++j)
+									cY[j] += value * bX[j * b.col];
+						}
+					}
+				});
+
+				return mat;
+			}
+		}
+
+		//Sparse x dense vector
+		auto dotProduct(const std::vector<Type> &v, const Parallel &par = Parallel::global()) const
+		{
+			if (m_dim[0] != v.size())
+				throw Log("SparseMatrix: dotProduct: width not same as vector size.", Log::Severity::ERR0R);
+
+			std::vector<Type> result(m_dim[1], Type(0));
+
+			_parallelRows_(nonZeros(), par, [this, &v, &result](const size_t &begin, const size_t &end)
+			{
+				for (size_t y = begin; y < end; ++y)
+				{
+					Type sum = 0;
+					for (size_t k = m_rowPtr[y]; k < m_rowPtr[y + 1]; ++k)
+						sum += m_values[k] * v[m_colIdx[k]];
+					result[y] = sum;
+				}
+			});
+
+			return result;
+		}
+
+		auto toMatrix() const
+		{
+			Matrix<Type> mat({ m_dim[0], m_dim[1] }, 0);
+
+			for (size_t y = 0; y < m_dim[1]; ++y)
+				for (size_t k = m_rowPtr[y]; k < m_rowPtr[y + 1]; ++k)
+					mat(m_colIdx[k], y) = m_values[k];
+
+			return mat;
+		}
+
+	private:
+		//Calls func(rowBegin, rowEnd) on ranges holding about the same number of non zeros
+		template<typename F>
+		void _parallelRows_(const size_t &work, const Parallel &par, F &&func) const
+		{
+			const auto threads = std::min(par.count(work), m_dim[1]);
+			if (threads <= 1)
+				return func(size_t(0), m_dim[1]);
+
+			ThreadPool::global().parallelFor(threads, [this, threads, &func](const size_t &i)
+			{
+				func(_rowAt_(nonZeros() * i / threads), i + 1 == threads ? m_dim[1] : _rowAt_(nonZeros() * (i + 1) / threads));
+			});
+		}
+
+		//First row starting at or after the nz-th non zero
+		size_t _rowAt_(const size_t &nz) const
+		{
+			return std::lower_bound(m_rowPtr.begin(), m_rowPtr.end() - 1, nz) - m_rowPtr.begin();
+		}
+
+		std::vector<size_t> m_rowPtr;
+		std::vector<size_t> m_colIdx;
+		std::vector<Type> m_values;
+		NumVec<size_t, 2> m_dim = { 0, 0 };
+	};
+}
\ No newline at end of file
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+namespace ctl
+{
+	class ThreadPool
+	{
+	public:
+		//---------------------------------------------------------
+		//--------------------Constructors-------------------------
+		//---------------------------------------------------------
+
+		//The calling thread works too, so threads - 1 workers are started
+		ThreadPool(const size_t &threads = std::max<size_t>(1, std::thread::hardware_concurrency()))
+		{
+			for (size_t i = 1; i < threads; ++i)
+				m_workers.emplace_back(&ThreadPool::_work_, this);
+		}
+
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool& operator=(const ThreadPool &) = delete;
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+
+			for (auto& i : m_workers)
+				i.join();
+		}
+
+		//---------------------------------------------------------
+		//------------------------Methods--------------------------
+		//---------------------------------------------------------
+
+		//Shared by the library, sized to the hardware
+		static ThreadPool& global()
+		{
+			static ThreadPool pool;
+			return pool;
+		}
+
+		size_t size() const { return m_workers.size() + 1; }
+
+		//Calls func(i) for every i in [0, count) and returns when all are done.
+		//Runs inline when called from a worker so nested calls can't deadlock.
+		//The job lives on this frame until every worker has left it, so a call doesn't allocate
+		template<typename F>
+		void parallelFor(const size_t &count, F &&func)
+		{
+			if (count == 0)
+				return;
+			if (count == 1 || m_workers.empty() || _inWorker_())
+			{
+				for (size_t i = 0; i < count; ++i)
+					func(i);
+				return;
+			}
+
+			using Func = std::remove_reference_t<F>;
+
+			_Job_ job;
+			job.count = count;
+			job.func = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+			job.call = [](void *f, const size_t &i) { (*static_cast<Func*>(f))(i); };
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				_push_(&job);
+			}
+			m_wake.notify_all();
+
+			_run_(job);
+
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_finished.wait(lock, [&job] { return job.done == job.count && job.users == 0; });
+				_remove_(&job);
+			}
+
+			if (job.error)
+				std::rethrow_exception(job.error);
+		}
+
+		//Splits [0, size) into at most parts contiguous ranges and calls func(begin, end) on each
+		template<typename F>
+		void parallelRange(const size_t &size, const size_t &parts, F &&func)
+		{
+			if (size == 0)
+				return;
+
+			const auto step = (size + std::max<size_t>(1, parts) - 1) / std::max<size_t>(1, parts);
+
+			parallelFor((size + step - 1) / step, [&](const size_t &i)
+			{
+				func(i * step, std::min(size, (i + 1) * step));
+			});
+		}
+
+	private:
+		//On the stack of the parallelFor call, the queue links them through later
+		struct _Job_
+		{
+			size_t count = 0;
+			void (*call)(void *, const size_t &) = nullptr;
+			void *func = nullptr;
+			std::atomic<size_t> next{ 0 };
+			//The rest are guarded by m_mutex
+			size_t done = 0;
+			//Workers inside _run_, the caller waits for them to leave
+			size_t users = 0;
+			std::exception_ptr error;
+			_Job_ *later = nullptr;
+		};
+
+		void _push_(_Job_ *job)
+		{
+			if (m_last)
+				m_last->later = job;
+			else
+				m_first = job;
+			m_last = job;
+		}
+
+		//Unlinks job if it's still queued
+		void _remove_(_Job_ *job)
+		{
+			_Job_ *before = nullptr;
+			for (auto *i = m_first; i; before = i, i = i->later)
+				if (i == job)
+				{
+					(before ? before->later : m_first) = job->later;
+					if (m_last == job)
+						m_last = before;
+					job->later = nullptr;
+					return;
+				}
+		}
+
+		static bool& _inWorker_()
+		{
+			thread_local bool worker = false;
+			return worker;
+		}
+
+		//Take chunks until none are left
+		void _run_(_Job_ &job)
+		{
+			for (size_t i; (i = job.next++) < job.count;)
+			{
+				std::exception_ptr error;
+				try { job.call(job.func, i); }
+				catch (...) { error = std::current_exception(); }
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (error && !job.error)
+					job.error = error;
+				if (++job.done == job.count)
+					m_finished.notify_all();
+			}
+		}
+
+		void _work_()
+		{
+			_inWorker_() = true;
+
+			while (true)
+			{
+				_Job_ *job;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [this] { return m_stop || m_first; });
+					if (m_stop)
+						return;
+
+					job = m_first;
+					//Every chunk is taken, the remaining ones are only being finished
+					if (job->next >= job->count)
+					{
+						_remove_(job);
+						continue;
+					}
+					++job->users;
+				}
+
+				_run_(*job);
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--job->users == 0)
+					m_finished.notify_all();
+			}
+		}
+
+		std::vector<std::thread> m_workers;
+		//Queued jobs, oldest first
+		_Job_ *m_first = nullptr;
+		_Job_ *m_last = nullptr;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_finished;
+		bool m_stop = false;
+	};
+
+	//How much of the global pool an operation may use
+	struct Parallel
+	{
+		//0 uses the whole pool, 1 stays on the calling thread, more than the pool oversubscribes it
+		size_t threads = 0;
+		//Below this many operations the work stays on the calling thread
+		size_t threshold = size_t(1) << 16;
+
+		//Used by operators and by calls that don't pass their own
+		static Parallel& global()
+		{
+			static Parallel par;
+			return par;
+		}
+
+		//Threads to use for size operations
+		size_t count(const size_t &size) const
+		{
+			if (size < threshold)
+				return 1;
+
+			return threads == 0 ? ThreadPool::global().size() : threads;
+		}
+	};
+}
\ No newline at end of file
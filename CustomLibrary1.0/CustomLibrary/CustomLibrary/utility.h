@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <type_traits>
 #include <array>
 #include <string_view>